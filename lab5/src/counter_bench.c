@@ -0,0 +1,348 @@
+/********************************************************
+ * counter_bench.c
+ *
+ * Микробенчмарк разделяемого счётчика на основе mutex.c:
+ * та же операция "прочитать - посчитать - записать обратно",
+ * защищённая разными примитивами синхронизации.
+ *
+ * Методы: racy (без защиты, как mutex.c с закомментированным
+ * мьютексом), mutex, spin, ticket, atomic, sharded.
+ * Перебираются число потоков и длина критической секции,
+ * результат печатается в CSV.
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CACHE_LINE 64
+#define MAX_LIST 32
+
+enum method {
+  M_RACY,
+  M_MUTEX,
+  M_SPIN,
+  M_TICKET,
+  M_ATOMIC,
+  M_SHARDED,
+  M_COUNT
+};
+
+static const char *method_names[M_COUNT] = {"racy",   "mutex",  "spin",
+                                            "ticket", "atomic", "sharded"};
+
+struct ticket_lock {
+  atomic_uint next;
+  atomic_uint serving;
+};
+
+/* Счётчик и поток-локальные данные выровнены по кэш-линии,
+ * чтобы false sharing не искажал сравнение методов. */
+struct thread_slot {
+  pthread_t tid;
+  unsigned long ops;
+  unsigned long shard;
+  char pad[CACHE_LINE - sizeof(pthread_t) - 2 * sizeof(unsigned long)];
+} __attribute__((aligned(CACHE_LINE)));
+
+static volatile unsigned long common __attribute__((aligned(CACHE_LINE)));
+static atomic_ulong common_atomic __attribute__((aligned(CACHE_LINE)));
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_spinlock_t spin;
+static struct ticket_lock ticket;
+
+static pthread_barrier_t start_barrier;
+static atomic_bool stop_flag;
+static enum method cur_method;
+static unsigned long cur_cs_len;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/* После SPIN_LIMIT холостых итераций ожидающий поток уступает процессор,
+ * иначе при потоков больше, чем ядер, владелец очереди может не получить
+ * квант времени. */
+#define SPIN_LIMIT 1024
+
+static void ticket_lock(struct ticket_lock *l) {
+  unsigned int my = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+  unsigned int spins = 0;
+  while (atomic_load_explicit(&l->serving, memory_order_acquire) != my) {
+    cpu_relax();
+    if (++spins == SPIN_LIMIT) {
+      spins = 0;
+      sched_yield();
+    }
+  }
+}
+
+static void ticket_unlock(struct ticket_lock *l) {
+  unsigned int cur = atomic_load_explicit(&l->serving, memory_order_relaxed);
+  atomic_store_explicit(&l->serving, cur + 1, memory_order_release);
+}
+
+/* "Длинный цикл" из mutex.c: работа внутри критической секции */
+static inline unsigned long long_cycle(unsigned long work, unsigned long len) {
+  for (unsigned long k = 0; k < len; k++)
+    __asm__ volatile("" : "+r"(work));
+  return work;
+}
+
+static void *worker(void *arg) {
+  struct thread_slot *slot = arg;
+  unsigned long ops = 0;
+  unsigned long len = cur_cs_len;
+
+  pthread_barrier_wait(&start_barrier);
+
+  while (!atomic_load_explicit(&stop_flag, memory_order_relaxed)) {
+    unsigned long work;
+    switch (cur_method) {
+    case M_RACY:
+      work = common;
+      work = long_cycle(work + 1, len); /* increment, but not write */
+      common = work;                    /* write back */
+      break;
+    case M_MUTEX:
+      pthread_mutex_lock(&mut);
+      work = common;
+      work = long_cycle(work + 1, len);
+      common = work;
+      pthread_mutex_unlock(&mut);
+      break;
+    case M_SPIN:
+      pthread_spin_lock(&spin);
+      work = common;
+      work = long_cycle(work + 1, len);
+      common = work;
+      pthread_spin_unlock(&spin);
+      break;
+    case M_TICKET:
+      ticket_lock(&ticket);
+      work = common;
+      work = long_cycle(work + 1, len);
+      common = work;
+      ticket_unlock(&ticket);
+      break;
+    case M_ATOMIC:
+      /* Инкремент неделим сам по себе, поэтому работа выполняется
+       * вне счётчика, а запись - одной операцией fetch_add. */
+      work = long_cycle(1, len);
+      atomic_fetch_add_explicit(&common_atomic, work, memory_order_relaxed);
+      break;
+    case M_SHARDED:
+      work = long_cycle(1, len);
+      slot->shard += work;
+      break;
+    default:
+      break;
+    }
+    ops++;
+  }
+
+  slot->ops = ops;
+  return NULL;
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_list(const char *str, unsigned long *out, int max) {
+  int n = 0;
+  char *copy = strdup(str);
+  for (char *tok = strtok(copy, ","); tok && n < max; tok = strtok(NULL, ","))
+    out[n++] = strtoul(tok, NULL, 10);
+  free(copy);
+  return n;
+}
+
+static int parse_methods(const char *str, bool *enabled) {
+  int n = 0;
+  char *copy = strdup(str);
+  for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+    int m;
+    for (m = 0; m < M_COUNT; m++) {
+      if (strcmp(tok, method_names[m]) == 0 || strcmp(tok, "all") == 0) {
+        enabled[m] = true;
+        n++;
+        if (strcmp(tok, "all") != 0)
+          break;
+      }
+    }
+    if (m == M_COUNT && strcmp(tok, "all") != 0) {
+      fprintf(stderr, "Unknown method: %s\n", tok);
+      free(copy);
+      return -1;
+    }
+  }
+  free(copy);
+  return n;
+}
+
+static void run_one(enum method m, int threads, unsigned long cs_len,
+                    int duration_ms) {
+  struct thread_slot *slots;
+  if (posix_memalign((void **)&slots, CACHE_LINE, threads * sizeof(*slots))) {
+    perror("posix_memalign");
+    exit(1);
+  }
+  memset(slots, 0, threads * sizeof(*slots));
+
+  common = 0;
+  atomic_store(&common_atomic, 0);
+  atomic_store(&ticket.next, 0);
+  atomic_store(&ticket.serving, 0);
+  pthread_barrier_init(&start_barrier, NULL, threads + 1);
+  atomic_store(&stop_flag, false);
+  cur_method = m;
+  cur_cs_len = cs_len;
+
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&slots[i].tid, NULL, worker, &slots[i]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+
+  pthread_barrier_wait(&start_barrier);
+  double t0 = now_sec();
+  struct timespec ts = {duration_ms / 1000, (duration_ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+  atomic_store_explicit(&stop_flag, true, memory_order_relaxed);
+
+  for (int i = 0; i < threads; i++) {
+    if (pthread_join(slots[i].tid, NULL) != 0) {
+      perror("pthread_join");
+      exit(1);
+    }
+  }
+  double elapsed = now_sec() - t0;
+  pthread_barrier_destroy(&start_barrier);
+
+  /* Сумма операций по потокам и итоговое значение счётчика */
+  unsigned long total = 0, min_ops = (unsigned long)-1, max_ops = 0;
+  double sum = 0, sum_sq = 0;
+  unsigned long counter;
+  for (int i = 0; i < threads; i++) {
+    unsigned long o = slots[i].ops;
+    total += o;
+    sum += o;
+    sum_sq += (double)o * o;
+    if (o < min_ops)
+      min_ops = o;
+    if (o > max_ops)
+      max_ops = o;
+  }
+
+  switch (m) {
+  case M_ATOMIC:
+    counter = atomic_load(&common_atomic);
+    break;
+  case M_SHARDED:
+    /* Слияние шардов в конце прогона */
+    counter = 0;
+    for (int i = 0; i < threads; i++)
+      counter += slots[i].shard;
+    break;
+  default:
+    counter = common;
+    break;
+  }
+
+  /* Индекс справедливости Джайна: 1.0 - все потоки сделали поровну */
+  double jain = sum_sq > 0 ? (sum * sum) / (threads * sum_sq) : 0;
+  double min_max = max_ops ? (double)min_ops / max_ops : 0;
+
+  printf("%s,%d,%lu,%lu,%.3f,%.0f,%.4f,%.4f,%lu,%s\n", method_names[m],
+         threads, cs_len, total, elapsed, total / elapsed, jain, min_max,
+         counter, counter == total ? "yes" : "no");
+  fflush(stdout);
+  free(slots);
+}
+
+int main(int argc, char **argv) {
+  unsigned long threads[MAX_LIST] = {1, 2, 4, 8};
+  unsigned long cs_lens[MAX_LIST] = {0, 100, 1000};
+  int threads_n = 4, cs_n = 3;
+  int duration_ms = 200;
+  bool enabled[M_COUNT] = {false};
+  int methods_n = 0;
+
+  while (true) {
+    static struct option options[] = {{"threads", required_argument, 0, 't'},
+                                      {"cs", required_argument, 0, 'c'},
+                                      {"duration", required_argument, 0, 'd'},
+                                      {"methods", required_argument, 0, 'm'},
+                                      {0, 0, 0, 0}};
+    int c = getopt_long(argc, argv, "", options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 't':
+      threads_n = parse_list(optarg, threads, MAX_LIST);
+      break;
+    case 'c':
+      cs_n = parse_list(optarg, cs_lens, MAX_LIST);
+      break;
+    case 'd':
+      duration_ms = atoi(optarg);
+      break;
+    case 'm':
+      methods_n = parse_methods(optarg, enabled);
+      if (methods_n < 0)
+        return 1;
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [--threads 1,2,4] [--cs 0,100,1000] "
+              "[--duration ms] [--methods all|racy,mutex,spin,ticket,"
+              "atomic,sharded]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (methods_n == 0) {
+    for (int m = M_MUTEX; m < M_COUNT; m++)
+      enabled[m] = true;
+  }
+  if (duration_ms <= 0 || threads_n == 0 || cs_n == 0) {
+    fprintf(stderr, "Duration, threads and cs lists must be non-empty\n");
+    return 1;
+  }
+  for (int i = 0; i < threads_n; i++) {
+    if (threads[i] == 0) {
+      fprintf(stderr, "Thread count must be positive\n");
+      return 1;
+    }
+  }
+
+  pthread_spin_init(&spin, PTHREAD_PROCESS_PRIVATE);
+
+  printf("method,threads,cs_len,ops,seconds,ops_per_sec,jain_fairness,"
+         "min_max_ratio,counter,correct\n");
+  for (int m = 0; m < M_COUNT; m++) {
+    if (!enabled[m])
+      continue;
+    for (int t = 0; t < threads_n; t++)
+      for (int c = 0; c < cs_n; c++)
+        run_one(m, (int)threads[t], cs_lens[c], duration_ms);
+  }
+
+  pthread_spin_destroy(&spin);
+  return 0;
+}
@@ -0,0 +1,74 @@
+#!/bin/bash
+# Проверка допуска задач (--max-queue): сначала closed-прогоном
+# измеряется пропускная способность сервера, затем open-нагрузка
+# подаётся с частотой от половины до тройной ёмкости - на сервер
+# без ограничения очереди и на сервер с короткой очередью. Без
+# ограничения p99 растёт вместе с очередью, с ограничением лишние
+# задачи сразу получают STATUS_BUSY, а p99 принятых после насыщения
+# остаётся на одном уровне. Результат - CSV на stdout.
+#
+# Использование: ./admission_test.sh [max-queue] [порт] [tnum]
+
+max_queue=${1:-16}
+port=${2:-20103}
+tnum=${3:-2}
+duration=${DURATION:-3}
+range=${RANGE:-fixed:2000}
+factors=${FACTORS:-"0.5 0.8 1.0 1.5 2.0 3.0"}
+
+if [ ! -x ./server ] || [ ! -x ./loadgen ]; then
+    echo "Ошибка: сначала соберите server и loadgen (make)" >&2
+    exit 1
+fi
+
+tmp=$(mktemp -d)
+server_pid=
+
+start_server() {
+    ./server --port "$port" --tnum "$tnum" --log-level warn "$@" &
+    server_pid=$!
+    sleep 0.5
+}
+
+stop_server() {
+    kill "$server_pid" 2>/dev/null
+    wait "$server_pid" 2>/dev/null
+    server_pid=
+}
+
+cleanup() {
+    if [ -n "$server_pid" ]; then
+        stop_server
+    fi
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+# Ёмкость: closed-нагрузка с запасом задач в полёте
+start_server
+./loadgen --server "127.0.0.1:$port" --mode closed --connections 4 --inflight 4 \
+    --range "$range" --duration "$duration" --csv | tail -n 1 > "$tmp/capacity.csv"
+stop_server
+capacity=$(cut -d, -f10 "$tmp/capacity.csv")
+if [ -z "$capacity" ] || [ "${capacity%.*}" -le 0 ]; then
+    echo "Ошибка: не удалось измерить ёмкость сервера" >&2
+    exit 1
+fi
+echo "# capacity $capacity req/s, range $range, tnum $tnum" >&2
+
+echo "max_queue,load,rate,qps,busy,p50_ms,p99_ms"
+for queue in unbounded "$max_queue"; do
+    for factor in $factors; do
+        if [ "$queue" = unbounded ]; then
+            start_server
+        else
+            start_server --max-queue "$queue"
+        fi
+        rate=$(awk -v c="$capacity" -v f="$factor" 'BEGIN { printf "%.0f", c * f }')
+        ./loadgen --server "127.0.0.1:$port" --mode open --rate "$rate" --connections 4 \
+            --range "$range" --duration "$duration" --csv | tail -n 1 > "$tmp/run.csv"
+        stop_server
+        awk -F, -v q="$queue" -v f="$factor" -v r="$rate" '
+            { printf "%s,%.1f,%d,%.0f,%d,%.3f,%.3f\n", q, f, r, $10, $15, $11, $12 }' "$tmp/run.csv"
+    done
+done
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,107 +8,576 @@
 
 #include <errno.h>
 #include <getopt.h>
-#include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
-#include <pthread.h>
 
 #include "common.h"
-
+#include "kernel.h"
+#include "log.h"
+#include "sched.h"
+#include "trace.h"
+#include "transport.h"
+
+// Сервер отвечает не больше чем на окно задач, так что в буфер
+// целиком помещается любой кадр с ответами
+#define CLIENT_READ_SIZE (FRAME_HEADER_SIZE + SCHED_WINDOW_MAX * RESULT_MSG_SIZE)
+// Задач на сервер по умолчанию: k режется достаточно мелко, чтобы
+// медленный сервер задерживал финиш не больше чем на одну задачу
+#define DEFAULT_TASKS_PER_SERVER 64
+#define DEFAULT_CONNECT_TIMEOUT_MS 3000
+
+// Сервер из файла серверов: host:port, unix:/path или shm:name
 struct Server {
-    char ip[255];
-    int port;
+    char name[255];
+    // Адрес разрешается один раз до начала работы
+    struct TransportAddr addr;
 };
 
-struct ThreadData {
-    struct Server server;
-    uint64_t begin;
-    uint64_t end;
-    uint64_t mod;
-    uint64_t result;
-    int success;
-    pthread_t thread_id;
+enum ConnState {
+    CONN_CONNECTING,
+    CONN_HANDSHAKE,  // shm: сокет подключён, ждём сегмент от сервера
+    CONN_READY,
+    CONN_CLOSED,
 };
 
-void* ProcessServer(void* arg) {
-    struct ThreadData* data = (struct ThreadData*)arg;
-    
-    printf("Thread for server %s:%d started (range %lu-%lu)\n", 
-           data->server.ip, data->server.port, data->begin, data->end);
-    
-    struct hostent *hostname = gethostbyname(data->server.ip);
-    if (hostname == NULL) {
-        fprintf(stderr, "gethostbyname failed with %s\n", data->server.ip);
-        data->success = 0;
-        return NULL;
-    }
+// Соединение с сервером. Все соединения обслуживает один цикл на epoll:
+// connect, отправка задач и разбор ответов идут без блокировок
+struct ServerConn {
+    struct Server *server;
+    int index;
+    int fd;
+    enum ConnState state;
+    uint64_t connect_deadline;
+    uint32_t events;
+    struct FrameReader reader;
+    struct FrameWriter writer;
+    struct IoStats stats;
+    struct ShmChannel shm;  // для shm: кольца, fd остаётся управляющим сокетом
+    bool failed;
+};
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(data->server.port);
-    
-    memcpy(&server_addr.sin_addr, hostname->h_addr_list[0], hostname->h_length);
+struct Client {
+    int epoll_fd;
+    struct Scheduler *sched;
+    struct ServerConn *conns;
+    int conns_num;
+    uint64_t connect_timeout_ns;
+    uint32_t deadline_ms;  // дедлайн задачи на сервере, 0 - без дедлайна
+    uint64_t expired;      // задачи, остановленные сервером по дедлайну
+    uint64_t run_id;       // из него получаются trace_id задач
+    struct Trace *trace;   // NULL - трасса не пишется
+};
 
-    int sck = socket(AF_INET, SOCK_STREAM, 0);
+static bool ResolveServer(struct Server *server) {
+    const char *error = TransportResolve(server->name, &server->addr);
+    if (error != NULL) {
+        LOG_E("Can not resolve %s: %s", server->name, error);
+        return false;
+    }
+    return true;
+}
+
+// Блокирующее подключение для разовых запросов. Возвращает сокет или -1
+static int ConnectServer(const struct Server *server) {
+    int sck = socket(server->addr.addr.ss_family, SOCK_STREAM, 0);
     if (sck < 0) {
-        fprintf(stderr, "Socket creation failed for %s:%d!\n", 
-                data->server.ip, data->server.port);
-        data->success = 0;
-        return NULL;
+        LOG_E("Socket creation failed for %s!", server->name);
+        return -1;
     }
 
-    printf("Connecting to %s:%d...\n", data->server.ip, data->server.port);
-    
-    if (connect(sck, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        fprintf(stderr, "Connection to %s:%d failed\n", data->server.ip, data->server.port);
+    LOG_D("Connecting to %s...", server->name);
+
+    if (connect(sck, (const struct sockaddr *)&server->addr.addr, server->addr.addr_len) < 0) {
+        LOG_E("Connection to %s failed", server->name);
         close(sck);
-        data->success = 0;
-        return NULL;
+        return -1;
     }
+    return sck;
+}
 
-    printf("Connected to %s:%d, sending task...\n", data->server.ip, data->server.port);
-
-    char task[sizeof(uint64_t) * 3];
-    memcpy(task, &data->begin, sizeof(uint64_t));
-    memcpy(task + sizeof(uint64_t), &data->end, sizeof(uint64_t));
-    memcpy(task + 2 * sizeof(uint64_t), &data->mod, sizeof(uint64_t));
+// Запрашивает у сервера текстовую статистику и печатает её
+static bool PrintServerStats(const struct Server *server) {
+    int sck = ConnectServer(server);
+    if (sck < 0)
+        return false;
 
-    if (send(sck, task, sizeof(task), 0) < 0) {
-        fprintf(stderr, "Send failed to %s:%d\n", data->server.ip, data->server.port);
+    struct ShmChannel shm;
+    bool is_shm = server->addr.type == TRANSPORT_SHM;
+    if (is_shm && !ShmConnect(&shm, sck, DEFAULT_CONNECT_TIMEOUT_MS)) {
+        LOG_E("Can not attach shared memory of %s", server->name);
         close(sck);
-        data->success = 0;
-        return NULL;
+        return false;
     }
 
-    char response[sizeof(uint64_t)];
-    if (recv(sck, response, sizeof(response), 0) < 0) {
-        fprintf(stderr, "Receive failed from %s:%d\n", data->server.ip, data->server.port);
+    struct IoStats stats = {0, 0, 0, 0};
+    struct FrameReader reader;
+    struct FrameWriter writer;
+    if (!ReaderInit(&reader, sck, FRAME_HEADER_SIZE + MAX_STATS_SIZE, &stats)) {
+        if (is_shm)
+            ShmClose(&shm);
         close(sck);
-        data->success = 0;
-        return NULL;
+        return false;
+    }
+    WriterInit(&writer, sck, &stats);
+    if (is_shm)
+        reader.shm = writer.shm = &shm;
+
+    struct FrameHeader header;
+    char *buf = WriterReserve(&writer, FRAME_HEADER_SIZE);
+    bool ok = buf != NULL;
+    if (ok) {
+        PutFrameHeader(buf, MSG_STATS_REQUEST, 0);
+        ok = WriterFlush(&writer) == 1 && ReaderNeed(&reader, FRAME_HEADER_SIZE) &&
+             GetFrameHeader(ReaderPeek(&reader), &header) && header.type == MSG_STATS;
+    }
+    if (ok) {
+        ReaderConsume(&reader, FRAME_HEADER_SIZE);
+        ok = ReaderNeed(&reader, header.count);
+    }
+    if (ok) {
+        printf("# %s\n%.*s", server->name, (int)header.count, ReaderPeek(&reader));
+    } else {
+        LOG_E("Can not get stats from %s", server->name);
     }
 
-    memcpy(&data->result, response, sizeof(uint64_t));
-    data->success = 1;
-    
-    printf("Server %s:%d completed with result: %lu\n", 
-           data->server.ip, data->server.port, data->result);
-    
+    ReaderDestroy(&reader);
+    WriterDestroy(&writer);
+    if (is_shm)
+        ShmClose(&shm);
     close(sck);
-    return NULL;
+    return ok;
+}
+
+static void ConnSetEvents(struct Client *client, struct ServerConn *conn, uint32_t events) {
+    // Подписка shm-соединения не меняется: о данных и о месте в кольце
+    // сервер сообщает через eventfd
+    if (events == conn->events || conn->shm.seg != NULL)
+        return;
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = conn;
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->events = events;
+}
+
+// Закрывает соединение. При отказе задачи сервера уходят планировщику
+// на повтор
+static void ConnClose(struct Client *client, struct ServerConn *conn, bool failed) {
+    if (conn->state == CONN_CLOSED)
+        return;
+    if (conn->shm.seg != NULL) {
+        epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, conn->shm.wake_fd, NULL);
+        ShmClose(&conn->shm);
+    }
+    if (conn->fd >= 0) {
+        epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    if (conn->state == CONN_READY) {
+        ReaderDestroy(&conn->reader);
+        WriterDestroy(&conn->writer);
+    }
+    conn->state = CONN_CLOSED;
+    if (failed) {
+        conn->failed = true;
+        if (client->trace != NULL)
+            TraceServerFailed(client->trace, conn->index);
+        SchedFail(client->sched, conn->index);
+    }
+}
+
+// Неблокирующий connect; завершение придёт событием EPOLLOUT
+static void ConnStart(struct Client *client, struct ServerConn *conn) {
+    struct Server *server = conn->server;
+    conn->state = CONN_CONNECTING;
+    conn->connect_deadline = NowNs() + client->connect_timeout_ns;
+    if (client->trace != NULL)
+        TraceConnectStart(client->trace, conn->index, server->name);
+
+    if (server->addr.addr_len == 0) {
+        ConnClose(client, conn, true);
+        return;
+    }
+
+    conn->fd = socket(server->addr.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn->fd < 0) {
+        LOG_E("Socket creation failed for %s!", server->name);
+        ConnClose(client, conn, true);
+        return;
+    }
+
+    LOG_D("Connecting to %s...", server->name);
+    if (connect(conn->fd, (const struct sockaddr *)&server->addr.addr, server->addr.addr_len) < 0 &&
+        errno != EINPROGRESS) {
+        LOG_E("Connection to %s failed: %s", server->name, strerror(errno));
+        ConnClose(client, conn, true);
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+        LOG_E("epoll_ctl failed for %s", server->name);
+        ConnClose(client, conn, true);
+        return;
+    }
+    conn->events = EPOLLOUT;
+}
+
+// Буферы кадров и подписка: после connect, для shm - после получения сегмента
+static void ConnReady(struct Client *client, struct ServerConn *conn) {
+    if (!ReaderInit(&conn->reader, conn->fd, CLIENT_READ_SIZE, &conn->stats)) {
+        LOG_E("Memory allocation failed");
+        ConnClose(client, conn, true);
+        return;
+    }
+    WriterInit(&conn->writer, conn->fd, &conn->stats);
+    conn->state = CONN_READY;
+
+    if (conn->shm.seg == NULL) {
+        ConnSetEvents(client, conn, EPOLLIN);
+    } else {
+        // Сокет дальше нужен только для того, чтобы заметить отключение сервера
+        ConnSetEvents(client, conn, EPOLLRDHUP);
+        conn->reader.shm = conn->writer.shm = &conn->shm;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, conn->shm.wake_fd, &ev) < 0) {
+            LOG_E("Can not attach shared memory of %s", conn->server->name);
+            ConnClose(client, conn, true);
+            return;
+        }
+    }
+    if (client->trace != NULL)
+        TraceConnectDone(client->trace, conn->index);
+    LOG_D("Connected to %s", conn->server->name);
+}
+
+// Сервер отправляет сегмент сразу после accept. Ждём его по EPOLLIN,
+// не блокируя остальные соединения; срок - тот же таймаут подключения
+static void ConnHandshake(struct Client *client, struct ServerConn *conn) {
+    int ready = ShmTryConnect(&conn->shm, conn->fd);
+    if (ready == 0)
+        return;
+    if (ready < 0) {
+        LOG_E("Can not attach shared memory of %s", conn->server->name);
+        ConnClose(client, conn, true);
+        return;
+    }
+    ConnReady(client, conn);
+}
+
+static void ConnConnected(struct Client *client, struct ServerConn *conn) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        LOG_E("Connection to %s failed: %s",
+              conn->server->name, strerror(error ? error : errno));
+        ConnClose(client, conn, true);
+        return;
+    }
+    if (conn->server->addr.type == TRANSPORT_SHM) {
+        conn->state = CONN_HANDSHAKE;
+        ConnSetEvents(client, conn, EPOLLIN);
+        // Сегмент часто уже лежит в сокете
+        ConnHandshake(client, conn);
+        return;
+    }
+    ConnReady(client, conn);
+}
+
+// Забирает у планировщика задачи в пределах окна сервера и отправляет
+// их одним кадром MSG_TASKS. Недописанное уходит по EPOLLOUT
+static void ConnPump(struct Client *client, struct ServerConn *conn) {
+    if (conn->state != CONN_READY)
+        return;
+
+    struct ClientTask *batch[SCHED_WINDOW_MAX];
+    int taken = SchedTake(client->sched, conn->index, batch, SCHED_WINDOW_MAX);
+    bool ok = true;
+    if (taken > 0) {
+        char *header = WriterReserve(&conn->writer, FRAME_HEADER_SIZE);
+        ok = header != NULL;
+        if (ok)
+            PutFrameHeader(header, MSG_TASKS, (uint32_t)taken);
+        for (int i = 0; ok && i < taken; i++) {
+            struct TaskMsg task;
+            task.id = batch[i]->id;
+            task.args = batch[i]->args;
+            task.timeout_ms = client->deadline_ms;
+            task.trace_id = TraceId(client->run_id, task.id);
+            char *buf = WriterReserve(&conn->writer, TASK_MSG_SIZE);
+            ok = buf != NULL;
+            if (ok)
+                PutTask(buf, &task);
+            if (ok && client->trace != NULL)
+                TraceQueued(client->trace, conn->index, task.id, &task.args);
+        }
+    }
+
+    if (ok && WriterPending(&conn->writer) && WriterFlush(&conn->writer) < 0)
+        ok = false;
+    if (ok && client->trace != NULL && !WriterPending(&conn->writer))
+        TraceWritten(client->trace, conn->index);
+    if (!ok) {
+        LOG_W("Send failed to %s", conn->server->name);
+        ConnClose(client, conn, true);
+        return;
+    }
+    ConnSetEvents(client, conn, EPOLLIN | (WriterPending(&conn->writer) ? EPOLLOUT : 0));
+}
+
+// Разбирает кадры MSG_RESULTS, которые уже целиком лежат в буфере
+static bool ConnProcessResults(struct Client *client, struct ServerConn *conn) {
+    struct FrameReader *reader = &conn->reader;
+    while (ReaderAvailable(reader) >= FRAME_HEADER_SIZE) {
+        struct FrameHeader header;
+        if (!GetFrameHeader(ReaderPeek(reader), &header) || header.type != MSG_RESULTS ||
+            header.count > SCHED_WINDOW_MAX)
+            return false;
+        size_t frame_size = FRAME_HEADER_SIZE + (size_t)header.count * RESULT_MSG_SIZE;
+        if (ReaderAvailable(reader) < frame_size)
+            break;
+        ReaderConsume(reader, FRAME_HEADER_SIZE);
+
+        for (uint32_t i = 0; i < header.count; i++) {
+            struct ResultMsg result;
+            GetResult(ReaderPeek(reader), &result);
+            ReaderConsume(reader, RESULT_MSG_SIZE);
+            if (client->trace != NULL)
+                TraceReceived(client->trace, conn->index, &result);
+
+            bool known;
+            if (result.status == STATUS_OK) {
+                known = SchedComplete(client->sched, conn->index, result.id, result.value);
+            } else if (result.status == STATUS_BUSY) {
+                LOG_D("Server %s is busy, retry after %lu ms", conn->server->name, result.value);
+                known = SchedBusy(client->sched, conn->index, result.id, result.value * 1000000ULL);
+            } else {
+                if (result.status == STATUS_EXPIRED)
+                    client->expired++;
+                LOG_W("Task %lu failed on %s with status %u, retrying",
+                      result.id, conn->server->name, result.status);
+                known = SchedRetry(client->sched, conn->index, result.id);
+            }
+            if (!known) {
+                LOG_E("Unexpected result for task %lu from %s",
+                        result.id, conn->server->name);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void ConnHandle(struct Client *client, struct ServerConn *conn, uint32_t events) {
+    if (conn->state == CONN_CONNECTING) {
+        if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+            ConnConnected(client, conn);
+        ConnPump(client, conn);
+        return;
+    }
+    if (conn->state == CONN_HANDSHAKE) {
+        ConnHandshake(client, conn);
+        ConnPump(client, conn);
+        return;
+    }
+    if (conn->state != CONN_READY)
+        return;
+
+    if (conn->shm.seg != NULL) {
+        if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+            LOG_W("Server %s disconnected", conn->server->name);
+            ConnClose(client, conn, true);
+            return;
+        }
+        // Счётчик eventfd сбрасываем до чтения кольца: данные, пришедшие
+        // после чтения, разбудят нас снова
+        ShmDrainWake(&conn->shm);
+        ReaderFill(&conn->reader);
+        if (!ConnProcessResults(client, conn)) {
+            ConnClose(client, conn, true);
+            return;
+        }
+        if (ShmReadable(&conn->shm))
+            ShmWakeSelf(&conn->shm);
+        ConnPump(client, conn);
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        // Один recv на событие: epoll работает по уровню и вернёт
+        // соединение снова, если в сокете остались данные
+        long n = ReaderFill(&conn->reader);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            LOG_W("Receive failed from %s", conn->server->name);
+            ConnClose(client, conn, true);
+            return;
+        }
+        if (!ConnProcessResults(client, conn)) {
+            ConnClose(client, conn, true);
+            return;
+        }
+    }
+    ConnPump(client, conn);
+}
+
+// Таймауты подключения и задач проверяются раз в SCHED_POLL_MS
+static void ClientCheckTimeouts(struct Client *client) {
+    uint64_t now = NowNs();
+    for (int i = 0; i < client->conns_num; i++) {
+        struct ServerConn *conn = &client->conns[i];
+        if ((conn->state == CONN_CONNECTING || conn->state == CONN_HANDSHAKE) &&
+            now > conn->connect_deadline) {
+            LOG_W("Connection to %s timed out", conn->server->name);
+            ConnClose(client, conn, true);
+        } else if (conn->state == CONN_READY && SchedExpired(client->sched, conn->index)) {
+            LOG_W("Server %s timed out", conn->server->name);
+            ConnClose(client, conn, true);
+        }
+    }
+}
+
+// Главный цикл: все подключения запускаются сразу, дальше отправка
+// и приём идут по событиям epoll. Новые задачи серверу выдаются после
+// каждого его кадра с ответами, а по таймеру - всем серверам, чтобы
+// подхватить задачи отказавших и дубли для хеджа
+static bool ClientRun(struct Client *client) {
+    client->epoll_fd = epoll_create1(0);
+    if (client->epoll_fd < 0) {
+        LOG_E("epoll_create1 failed: %s", strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < client->conns_num; i++)
+        ConnStart(client, &client->conns[i]);
+
+    struct epoll_event events[64];
+    uint64_t next_tick = NowNs() + SCHED_POLL_MS * 1000000ULL;
+    while (!SchedFinished(client->sched)) {
+        uint64_t now = NowNs();
+        int timeout_ms = now >= next_tick ? 0 : (int)((next_tick - now + 999999) / 1000000);
+        int n = epoll_wait(client->epoll_fd, events, 64, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            LOG_E("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++)
+            ConnHandle(client, events[i].data.ptr, events[i].events);
+
+        if (NowNs() >= next_tick) {
+            ClientCheckTimeouts(client);
+            for (int i = 0; i < client->conns_num; i++)
+                ConnPump(client, &client->conns[i]);
+            next_tick = NowNs() + SCHED_POLL_MS * 1000000ULL;
+        }
+    }
+
+    // Ответы проигравших дублей не ждём
+    for (int i = 0; i < client->conns_num; i++)
+        ConnClose(client, &client->conns[i], false);
+    close(client->epoll_fd);
+    return true;
+}
+
+// Запрос для печати: "k!" для факториала, "sum(1..k)" для остальных ядер
+static const char *QueryLabel(const struct Query *query, char *buf, size_t size) {
+    if (query->type == TASK_FACTORIAL)
+        snprintf(buf, size, "%lu!", query->k);
+    else
+        snprintf(buf, size, "%s(1..%lu)", query->kernel->name, query->k);
+    return buf;
+}
+
+// Читает пакет запросов: по строке "k [mod [task]]", пустые строки
+// и строки с # пропускаются. Без mod берётся default_mod, без типа
+// задачи - default_type. Возвращает число запросов или -1
+static int ReadQueries(const char *path, uint64_t default_mod, uint32_t default_type,
+                       struct Query **out) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open queries file: %s\n", path);
+        return -1;
+    }
+
+    struct Query *queries = NULL;
+    int queries_num = 0, capacity = 0;
+    char line[255];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+        char *k_str = strtok(line, " \t\r\n");
+        if (k_str == NULL || k_str[0] == '#')
+            continue;
+        char *mod_str = strtok(NULL, " \t\r\n");
+        char *type_str = mod_str != NULL ? strtok(NULL, " \t\r\n") : NULL;
+
+        struct Query query = {0, default_mod, default_type, 1, 0, 0, 0, NULL};
+        if (!ConvertStringToUI64(k_str, &query.k) || query.k == 0 ||
+            (mod_str != NULL && !ConvertStringToUI64(mod_str, &query.mod)) || query.mod == 0 ||
+            (type_str != NULL && !KernelParse(type_str, &query.type))) {
+            fprintf(stderr, "Invalid query at %s:%d (expected \"k mod [task]\")\n", path, line_num);
+            free(queries);
+            fclose(file);
+            return -1;
+        }
+
+        if (queries_num == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct Query *grown = realloc(queries, capacity * sizeof(struct Query));
+            if (grown == NULL) {
+                free(queries);
+                fclose(file);
+                return -1;
+            }
+            queries = grown;
+        }
+        queries[queries_num++] = query;
+    }
+    fclose(file);
+
+    *out = queries;
+    return queries_num;
 }
 
 int main(int argc, char **argv) {
     uint64_t k = 0;
     uint64_t mod = 0;
     char servers_file[255] = {'\0'};
+    uint64_t tasks_num = 0;
+    enum LogLevel log_level = LOG_INFO;
+    bool stats_mode = false;
+    uint64_t retries = SCHED_DEFAULT_RETRIES;
+    uint64_t timeout_ms = SCHED_DEFAULT_TIMEOUT_MS;
+    bool hedge = false;
+    const char *queries_file = NULL;
+    uint64_t connect_timeout_ms = DEFAULT_CONNECT_TIMEOUT_MS;
+    uint64_t deadline_ms = 0;
+    uint32_t task_type = TASK_FACTORIAL;
+    const char *trace_file = NULL;
 
     while (true) {
         static struct option options[] = {{"k", required_argument, 0, 0},
                                           {"mod", required_argument, 0, 0},
                                           {"servers", required_argument, 0, 0},
+                                          {"tasks", required_argument, 0, 0},
+                                          {"log-level", required_argument, 0, 0},
+                                          {"stats", no_argument, 0, 0},
+                                          {"retries", required_argument, 0, 0},
+                                          {"timeout", required_argument, 0, 0},
+                                          {"hedge", no_argument, 0, 0},
+                                          {"queries", required_argument, 0, 0},
+                                          {"connect-timeout", required_argument, 0, 0},
+                                          {"deadline", required_argument, 0, 0},
+                                          {"task", required_argument, 0, 0},
+                                          {"trace", required_argument, 0, 0},
                                           {0, 0, 0, 0}};
 
         int option_index = 0;
@@ -135,6 +605,62 @@ int main(int argc, char **argv) {
                 strncpy(servers_file, optarg, sizeof(servers_file) - 1);
                 servers_file[sizeof(servers_file) - 1] = '\0';
                 break;
+            case 3:
+                if (!ConvertStringToUI64(optarg, &tasks_num) || tasks_num == 0) {
+                    fprintf(stderr, "Invalid tasks value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 4:
+                if (!LogParseLevel(optarg, &log_level)) {
+                    fprintf(stderr, "Invalid log level: %s (debug, info, warn, error, off)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 5:
+                stats_mode = true;
+                break;
+            case 6:
+                if (!ConvertStringToUI64(optarg, &retries) || retries > 1000) {
+                    fprintf(stderr, "Invalid retries value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 7:
+                // 0 отключает таймаут задач
+                if (!ConvertStringToUI64(optarg, &timeout_ms)) {
+                    fprintf(stderr, "Invalid timeout value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 8:
+                hedge = true;
+                break;
+            case 9:
+                queries_file = optarg;
+                break;
+            case 10:
+                if (!ConvertStringToUI64(optarg, &connect_timeout_ms) || connect_timeout_ms == 0) {
+                    fprintf(stderr, "Invalid connect-timeout value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 11:
+                // Сервер бросает задачу, если не посчитал её за это время
+                if (!ConvertStringToUI64(optarg, &deadline_ms) || deadline_ms > UINT32_MAX) {
+                    fprintf(stderr, "Invalid deadline value: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 12:
+                if (!KernelParse(optarg, &task_type)) {
+                    fprintf(stderr, "Invalid task: %s (factorial, sum, product, min, max)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 13:
+                trace_file = optarg;
+                break;
             default:
                 printf("Index %d is out of options\n", option_index);
             }
@@ -148,8 +674,20 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (k == 0 || mod == 0 || !strlen(servers_file)) {
-        fprintf(stderr, "Using: %s --k 1000 --mod 5 --servers /path/to/file\n", argv[0]);
+    if ((!stats_mode && queries_file == NULL && (k == 0 || mod == 0)) || !strlen(servers_file)) {
+        fprintf(stderr, "Using: %s --k 1000 --mod 5 --servers /path/to/file [--tasks N] [--log-level info]\n"
+                        "       %*s [--retries 3] [--timeout ms] [--hedge] [--connect-timeout ms]\n"
+                        "       %*s [--deadline ms] [--task factorial|sum|product|min|max]\n"
+                        "       %*s [--trace /path/to/trace.json]\n"
+                        "       %s --queries /path/to/file [--mod 5] --servers /path/to/file [--tasks N]\n"
+                        "       %s --stats --servers /path/to/file\n",
+                argv[0], (int)strlen(argv[0]), "", (int)strlen(argv[0]), "", (int)strlen(argv[0]), "",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    if (!LogInit(log_level)) {
+        fprintf(stderr, "Can not start logger\n");
         return 1;
     }
 
@@ -167,25 +705,15 @@ int main(int argc, char **argv) {
         line[strcspn(line, "\n")] = 0;
         if (strlen(line) == 0) continue;
         
-        char* colon = strchr(line, ':');
-        if (colon == NULL) {
-            fprintf(stderr, "Invalid server format: %s (expected ip:port)\n", line);
+        // Транспорт задаётся префиксом: unix:/path, shm:name, иначе host:port
+        if (strchr(line, ':') == NULL) {
+            fprintf(stderr, "Invalid server format: %s (expected ip:port, unix:/path or shm:name)\n", line);
             continue;
         }
-        
-        *colon = '\0';
-        char* ip = line;
-        int port = atoi(colon + 1);
-        
-        if (port <= 0) {
-            fprintf(stderr, "Invalid port in: %s\n", line);
-            continue;
-        }
-        
+
         servers = realloc(servers, (servers_num + 1) * sizeof(struct Server));
-        strncpy(servers[servers_num].ip, ip, sizeof(servers[servers_num].ip) - 1);
-        servers[servers_num].ip[sizeof(servers[servers_num].ip) - 1] = '\0';
-        servers[servers_num].port = port;
+        strncpy(servers[servers_num].name, line, sizeof(servers[servers_num].name) - 1);
+        servers[servers_num].name[sizeof(servers[servers_num].name) - 1] = '\0';
         servers_num++;
     }
     fclose(file);
@@ -196,96 +724,185 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    printf("Found %d servers\n", servers_num);
+    LOG_I("Found %d servers", servers_num);
 
-    struct ThreadData* thread_data = malloc(servers_num * sizeof(struct ThreadData));
-    if (!thread_data) {
-        fprintf(stderr, "Memory allocation failed\n");
+    // Адреса разрешаются один раз до подключения; сервер с
+    // неразрешимым адресом считается отказавшим с самого начала
+    for (int i = 0; i < servers_num; i++) {
+        if (!ResolveServer(&servers[i]))
+            servers[i].addr.addr_len = 0;
+    }
+
+    if (stats_mode) {
+        bool all_ok = true;
+        for (int i = 0; i < servers_num; i++)
+            all_ok = servers[i].addr.addr_len > 0 && PrintServerStats(&servers[i]) && all_ok;
+        LogShutdown();
         free(servers);
-        return 1;
+        return all_ok ? 0 : 1;
     }
 
-    uint64_t numbers_per_server = k / servers_num;
-    uint64_t remainder = k % servers_num;
-    uint64_t current = 1;
+    struct ServerConn* conns = calloc(servers_num, sizeof(struct ServerConn));
+    if (!conns) {
+        LOG_E("Memory allocation failed");
+        free(servers);
+        return 1;
+    }
 
-    printf("\n=== Distributing work ===\n");
-    for (int i = 0; i < servers_num; i++) {
-        thread_data[i].server = servers[i];
-        thread_data[i].begin = current;
-        thread_data[i].end = current + numbers_per_server - 1;
-        
-        if ((uint64_t)i < remainder) {
-            thread_data[i].end++;
+    // Каждый запрос режется на tasks_num задач, которые серверы
+    // разбирают из общей очереди: кто быстрее считает, тот раньше
+    // возвращается за новыми. По умолчанию на весь пакет приходится
+    // DEFAULT_TASKS_PER_SERVER задач на сервер: одиночный k режется
+    // мелко, а тысячи запросов идут по задаче на запрос
+    struct Query single = {k, mod, task_type, 1, 0, 0, 0, NULL};
+    struct Query *queries = &single;
+    int queries_num = 1;
+    if (queries_file != NULL) {
+        queries_num = ReadQueries(queries_file, mod, task_type, &queries);
+        if (queries_num <= 0) {
+            if (queries_num == 0)
+                fprintf(stderr, "No queries found in file: %s\n", queries_file);
+            free(conns);
+            free(servers);
+            return 1;
         }
-        
-        thread_data[i].mod = mod;
-        thread_data[i].success = 0;
-        current = thread_data[i].end + 1;
+    }
+    if (tasks_num == 0) {
+        tasks_num = (uint64_t)servers_num * DEFAULT_TASKS_PER_SERVER / queries_num;
+        if (tasks_num == 0)
+            tasks_num = 1;
+    }
 
-        printf("Server %d (%s:%d): numbers %lu to %lu\n", 
-               i, servers[i].ip, servers[i].port, 
-               thread_data[i].begin, thread_data[i].end);
+    struct Scheduler sched;
+    if (!SchedInit(&sched, queries, queries_num, tasks_num, servers_num)) {
+        LOG_E("Memory allocation failed");
+        if (queries != &single)
+            free(queries);
+        free(conns);
+        free(servers);
+        return 1;
     }
+    sched.max_retries = (int)retries;
+    sched.timeout_ns = timeout_ms * 1000000ULL;
+    sched.hedge = hedge;
 
-    printf("\n=== Starting parallel execution ===\n");
+    LOG_I("=== Distributing work: %d queries in %zu tasks ===", queries_num, sched.tasks_num);
     for (int i = 0; i < servers_num; i++) {
-        if (pthread_create(&thread_data[i].thread_id, NULL, ProcessServer, &thread_data[i])) {
-            fprintf(stderr, "Error creating thread for server %d\n", i);
-            thread_data[i].success = 0;
-        } else {
-            printf("Started thread for server %s:%d\n", 
-                   thread_data[i].server.ip, thread_data[i].server.port);
-        }
+        conns[i].server = &servers[i];
+        conns[i].index = i;
+        conns[i].fd = -1;
     }
 
-
-    printf("\n=== Waiting for all servers to complete ===\n");
-    for (int i = 0; i < servers_num; i++) {
-        pthread_join(thread_data[i].thread_id, NULL);
+    // Трасса: по записи на каждую копию задачи, файл пишется после прогона
+    struct Trace trace;
+    struct Client client = {-1, &sched, conns, servers_num, connect_timeout_ms * 1000000ULL,
+                            (uint32_t)deadline_ms, 0, TraceRunId(), NULL};
+    if (trace_file != NULL) {
+        if (!TraceInit(&trace, client.run_id, sched.tasks_num, servers_num)) {
+            LOG_E("Memory allocation failed");
+            LogShutdown();
+            SchedDestroy(&sched);
+            if (queries != &single)
+                free(queries);
+            free(conns);
+            free(servers);
+            return 1;
+        }
+        client.trace = &trace;
     }
+    LOG_I("=== Starting parallel execution ===");
+    if (!ClientRun(&client))
+        SchedAbort(&sched);
+    uint64_t wall_ns = NowNs() - sched.start_ns;
 
-    printf("\n=== Collecting results ===\n");
-    uint64_t total_result = 1;
-    int all_success = 1;
-    int successful_servers = 0;
+    // Дописываем журнал до печати итогов, чтобы вывод не перемешался
+    LogShutdown();
 
+    // Доля работы и занятость сервера показывают, насколько ровно
+    // распределилась нагрузка: занятость - доля времени прогона,
+    // когда у сервера была хоть одна задача
+    printf("\n=== Collecting results ===\n");
+    uint64_t hedges = 0, hedges_won = 0;
+    double numbers_total = 0;
+    for (int q = 0; q < queries_num; q++)
+        numbers_total += queries[q].k;
     for (int i = 0; i < servers_num; i++) {
-        if (thread_data[i].success) {
-            total_result = MultModulo(total_result, thread_data[i].result, mod);
-            printf("Server %s:%d: result = %lu\n", 
-                   thread_data[i].server.ip, thread_data[i].server.port, thread_data[i].result);
-            successful_servers++;
-        } else {
-            printf("Server %s:%d: FAILED\n", 
-                   thread_data[i].server.ip, thread_data[i].server.port);
-            all_success = 0;
-        }
+        const struct ServerLoad *load = &sched.servers[i];
+        const struct IoStats *stats = &conns[i].stats;
+        // Задачи, на которые ответ так и не пришёл, тоже занимали сервер
+        uint64_t busy_ns = load->busy_ns;
+        if (load->inflight > 0)
+            busy_ns += sched.start_ns + wall_ns - load->busy_since;
+        printf("Server %s: %s tasks %lu (%.1f%% of numbers), utilization %.1f%%, "
+               "window %d, avg latency %.3f ms (recv %lu, send %lu)\n",
+               servers[i].name, conns[i].failed ? "FAILED," : "ok,",
+               load->tasks_done, 100.0 * load->numbers_done / numbers_total,
+               wall_ns ? 100.0 * busy_ns / wall_ns : 0.0,
+               load->window, load->avg_latency_ns / 1e6,
+               stats->read_calls, stats->write_calls);
+        if (load->tasks_lost > 0 || load->hedges > 0 || load->busy_replies > 0)
+            printf("    lost %lu tasks, hedged %lu (won %lu), rejected as busy %lu\n",
+                   load->tasks_lost, load->hedges, load->hedges_won, load->busy_replies);
+        hedges += load->hedges;
+        hedges_won += load->hedges_won;
+    }
+    printf("Task latency: p50 %.3f ms, p95 %.3f ms, max %.3f ms; "
+           "retries %lu, hedges %lu (won %lu)\n",
+           HistPercentile(&sched.latency_ns, 0.5) / 1e6,
+           HistPercentile(&sched.latency_ns, 0.95) / 1e6,
+           sched.latency_ns.max / 1e6, sched.retries, hedges, hedges_won);
+    if (client.expired > 0)
+        printf("Tasks expired on servers: %lu (deadline %lu ms)\n", client.expired, deadline_ms);
+    if (client.trace != NULL) {
+        if (!TraceWrite(client.trace, trace_file))
+            fprintf(stderr, "Can not write trace to %s\n", trace_file);
+        TraceDestroy(client.trace);
     }
 
+    // Результат верен, пока посчитаны все задачи, даже если
+    // часть серверов отказала по ходу прогона
+    bool all_success = !sched.aborted && sched.done_num == sched.tasks_num;
     printf("\n=== Final Results ===\n");
-    if (all_success) {
-        printf("All %d servers completed successfully\n", servers_num);
-        printf("Final result: %lu! mod %lu = %lu\n", k, mod, total_result);
-        
-        // Проверка
-        uint64_t sequential_result = 1;
-        for (uint64_t i = 1; i <= k; i++) {
-            sequential_result = MultModulo(sequential_result, i, mod);
+    if (!all_success) {
+        printf("%zu of %zu tasks completed. Cannot compute result.\n",
+               sched.done_num, sched.tasks_num);
+    } else if (queries_file != NULL) {
+        // Результаты в порядке файла; задержка запроса - от отправки
+        // его первой задачи до ответа на последнюю
+        struct Histogram query_ns;
+        memset(&query_ns, 0, sizeof(query_ns));
+        for (int q = 0; q < queries_num; q++) {
+            uint64_t latency = queries[q].done_ns - queries[q].start_ns;
+            HistRecord(&query_ns, latency);
+            char label[64];
+            printf("%s mod %lu = %lu (%.3f ms)\n", QueryLabel(&queries[q], label, sizeof(label)),
+                   queries[q].mod, queries[q].result, latency / 1e6);
         }
-        printf("Verification (sequential): %lu\n", sequential_result);
-        printf("Results match: %s\n", total_result == sequential_result ? "YES" : "NO");
-    } else if (successful_servers > 0) {
-        printf("%d of %d servers completed successfully\n", successful_servers, servers_num);
-        printf("Partial result: %lu! mod %lu = %lu\n", k, mod, total_result);
-        printf("WARNING: Result may be incorrect due to server failures\n");
+        printf("All %d queries completed in %.3f ms: %.0f queries/s\n",
+               queries_num, wall_ns / 1e6, queries_num / (wall_ns / 1e9));
+        printf("Query latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               HistPercentile(&query_ns, 0.5) / 1e6, HistPercentile(&query_ns, 0.99) / 1e6,
+               query_ns.max / 1e6);
     } else {
-        printf("All servers failed. Cannot compute result.\n");
+        printf("All %zu tasks completed in %.3f ms by %d of %d servers\n",
+               sched.tasks_num, wall_ns / 1e6, sched.servers_alive, servers_num);
+        char label[64];
+        printf("Final result: %s mod %lu = %lu\n", QueryLabel(&single, label, sizeof(label)),
+               mod, single.result);
+
+        // Проверка
+        struct FactorialArgs args = {1, k, mod, task_type};
+        uint64_t sequential_result = Factorial(&args);
+        printf("Verification (sequential): %lu\n", sequential_result);
+        printf("Results match: %s\n", single.result == sequential_result ? "YES" : "NO");
     }
 
     // Освобождение ресурсов
-    free(thread_data);
+    SchedDestroy(&sched);
+    if (queries != &single)
+        free(queries);
+    free(conns);
     free(servers);
-    
+
     return all_success ? 0 : 1;
-}
\ No newline at end of file
+}
@@ -1,6 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "common.h"
+#include "kernel.h"
+#include "transport.h"
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod) {
     uint64_t result = 0;
@@ -14,6 +24,53 @@ uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod) {
     return result % mod;
 }
 
+uint64_t NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t Factorial(const struct FactorialArgs *args) {
+    const struct Kernel *kernel = KernelGet(args->type);
+    if (args->begin > args->end)
+        return kernel->identity;
+    return kernel->range(kernel->identity, args->begin, args->end, args->mod);
+}
+
+static enum FactorialStop FactorialShouldStop(const struct FactorialCancel *cancel) {
+    if (cancel->cancelled != NULL && __atomic_load_n(cancel->cancelled, __ATOMIC_RELAXED))
+        return FACTORIAL_CANCELLED;
+    if (cancel->deadline_ns != 0 && NowNs() >= cancel->deadline_ns)
+        return FACTORIAL_EXPIRED;
+    return FACTORIAL_DONE;
+}
+
+enum FactorialStop FactorialChecked(const struct FactorialArgs *args,
+                                    const struct FactorialCancel *cancel,
+                                    uint64_t *result) {
+    const struct Kernel *kernel = KernelGet(args->type);
+    uint64_t ans = kernel->identity;
+    uint64_t i = args->begin;
+
+    while (true) {
+        enum FactorialStop stop = FactorialShouldStop(cancel);
+        if (stop != FACTORIAL_DONE)
+            return stop;
+
+        // Граница куска без переполнения при end около UINT64_MAX
+        uint64_t chunk_end = args->end;
+        if (chunk_end - i >= FACTORIAL_CHUNK)
+            chunk_end = i + FACTORIAL_CHUNK - 1;
+        ans = kernel->range(ans, i, chunk_end, args->mod);
+        if (chunk_end == args->end)
+            break;
+        i = chunk_end + 1;
+    }
+
+    *result = ans;
+    return FACTORIAL_DONE;
+}
+
 bool ConvertStringToUI64(const char *str, uint64_t *val) {
     char *end = NULL;
     unsigned long long i = strtoull(str, &end, 10);
@@ -26,4 +83,287 @@ bool ConvertStringToUI64(const char *str, uint64_t *val) {
 
     *val = i;
     return true;
-}
\ No newline at end of file
+}
+
+void PutFrameHeader(char *buf, uint8_t type, uint32_t count) {
+    uint16_t magic = PROTO_MAGIC;
+    memcpy(buf, &magic, sizeof(magic));
+    buf[2] = PROTO_VERSION;
+    buf[3] = (char)type;
+    memcpy(buf + 4, &count, sizeof(count));
+}
+
+bool GetFrameHeader(const char *buf, struct FrameHeader *header) {
+    memcpy(&header->magic, buf, sizeof(header->magic));
+    header->version = (uint8_t)buf[2];
+    header->type = (uint8_t)buf[3];
+    memcpy(&header->count, buf + 4, sizeof(header->count));
+
+    if (header->magic != PROTO_MAGIC || header->version != PROTO_VERSION)
+        return false;
+    if (header->type == MSG_STATS)
+        return header->count <= MAX_STATS_SIZE;
+    return header->count <= MAX_FRAME_TASKS;
+}
+
+void PutTask(char *buf, const struct TaskMsg *task) {
+    memcpy(buf, &task->id, sizeof(uint64_t));
+    memcpy(buf + 8, &task->args.begin, sizeof(uint64_t));
+    memcpy(buf + 16, &task->args.end, sizeof(uint64_t));
+    memcpy(buf + 24, &task->args.mod, sizeof(uint64_t));
+    memcpy(buf + 32, &task->timeout_ms, sizeof(uint32_t));
+    memcpy(buf + 36, &task->args.type, sizeof(uint32_t));
+    memcpy(buf + 40, &task->trace_id, sizeof(uint64_t));
+}
+
+void GetTask(const char *buf, struct TaskMsg *task) {
+    memcpy(&task->id, buf, sizeof(uint64_t));
+    memcpy(&task->args.begin, buf + 8, sizeof(uint64_t));
+    memcpy(&task->args.end, buf + 16, sizeof(uint64_t));
+    memcpy(&task->args.mod, buf + 24, sizeof(uint64_t));
+    memcpy(&task->timeout_ms, buf + 32, sizeof(uint32_t));
+    memcpy(&task->args.type, buf + 36, sizeof(uint32_t));
+    memcpy(&task->trace_id, buf + 40, sizeof(uint64_t));
+}
+
+void PutResult(char *buf, const struct ResultMsg *result) {
+    uint32_t reserved = 0;
+    memcpy(buf, &result->id, sizeof(uint64_t));
+    memcpy(buf + 8, &result->status, sizeof(uint32_t));
+    memcpy(buf + 12, &reserved, sizeof(uint32_t));
+    memcpy(buf + 16, &result->value, sizeof(uint64_t));
+    memcpy(buf + 24, &result->queue_ns, sizeof(uint64_t));
+    memcpy(buf + 32, &result->compute_ns, sizeof(uint64_t));
+}
+
+void GetResult(const char *buf, struct ResultMsg *result) {
+    memcpy(&result->id, buf, sizeof(uint64_t));
+    memcpy(&result->status, buf + 8, sizeof(uint32_t));
+    memcpy(&result->value, buf + 16, sizeof(uint64_t));
+    memcpy(&result->queue_ns, buf + 24, sizeof(uint64_t));
+    memcpy(&result->compute_ns, buf + 32, sizeof(uint64_t));
+}
+
+bool ReaderInit(struct FrameReader *reader, int fd, size_t cap, struct IoStats *stats) {
+    reader->buf = malloc(cap);
+    if (reader->buf == NULL)
+        return false;
+    reader->fd = fd;
+    reader->shm = NULL;
+    reader->cap = cap;
+    reader->start = 0;
+    reader->end = 0;
+    reader->stats = stats;
+    return true;
+}
+
+void ReaderDestroy(struct FrameReader *reader) {
+    free(reader->buf);
+    reader->buf = NULL;
+}
+
+long ReaderFill(struct FrameReader *reader) {
+    // Непрочитанный хвост переносится в начало, чтобы освободить место
+    if (reader->end == reader->cap && reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    if (reader->end == reader->cap) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (reader->shm != NULL) {
+        size_t n = ShmRecv(reader->shm, reader->buf + reader->end, reader->cap - reader->end);
+        if (n == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        reader->end += n;
+        reader->stats->bytes_in += n;
+        return (long)n;
+    }
+
+    while (true) {
+        ssize_t n = recv(reader->fd, reader->buf + reader->end, reader->cap - reader->end, 0);
+        reader->stats->read_calls++;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n > 0) {
+            reader->end += n;
+            reader->stats->bytes_in += n;
+        }
+        return n;
+    }
+}
+
+bool ReaderNeed(struct FrameReader *reader, size_t len) {
+    if (len > reader->cap)
+        return false;
+    while (ReaderAvailable(reader) < len) {
+        if (reader->cap - reader->start < len) {
+            memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+            reader->end -= reader->start;
+            reader->start = 0;
+        }
+        long n = ReaderFill(reader);
+        // Кольцо пусто: спим до пробуждения от собеседника
+        if (n < 0 && errno == EAGAIN && reader->shm != NULL) {
+            if (!ShmWait(reader->shm))
+                return false;
+            continue;
+        }
+        if (n <= 0)
+            return false;
+    }
+    return true;
+}
+
+void WriterInit(struct FrameWriter *writer, int fd, struct IoStats *stats) {
+    writer->fd = fd;
+    writer->shm = NULL;
+    writer->head = NULL;
+    writer->tail = NULL;
+    writer->spare = NULL;
+    writer->pending = 0;
+    writer->stats = stats;
+}
+
+void WriterDestroy(struct FrameWriter *writer) {
+    while (writer->head != NULL) {
+        struct WriterBlock *next = writer->head->next;
+        free(writer->head);
+        writer->head = next;
+    }
+    free(writer->spare);
+    writer->tail = NULL;
+    writer->spare = NULL;
+    writer->pending = 0;
+}
+
+char *WriterReserve(struct FrameWriter *writer, size_t len) {
+    struct WriterBlock *tail = writer->tail;
+    if (len > WRITER_BLOCK_SIZE)
+        return NULL;
+
+    if (tail == NULL || WRITER_BLOCK_SIZE - tail->len < len) {
+        // Один отправленный блок держим про запас, чтобы не звать malloc
+        // на каждый ответ
+        struct WriterBlock *block = writer->spare;
+        if (block != NULL)
+            writer->spare = NULL;
+        else if ((block = malloc(sizeof(struct WriterBlock))) == NULL)
+            return NULL;
+        block->next = NULL;
+        block->pos = 0;
+        block->len = 0;
+        if (tail != NULL)
+            tail->next = block;
+        else
+            writer->head = block;
+        writer->tail = tail = block;
+    }
+
+    char *ptr = tail->data + tail->len;
+    tail->len += len;
+    writer->pending += len;
+    return ptr;
+}
+
+bool WriterAppend(struct FrameWriter *writer, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        size_t chunk = len < WRITER_BLOCK_SIZE ? len : WRITER_BLOCK_SIZE;
+        if (writer->tail != NULL && writer->tail->len < WRITER_BLOCK_SIZE &&
+            WRITER_BLOCK_SIZE - writer->tail->len < chunk)
+            chunk = WRITER_BLOCK_SIZE - writer->tail->len;
+
+        char *dst = WriterReserve(writer, chunk);
+        if (dst == NULL)
+            return false;
+        memcpy(dst, p, chunk);
+        p += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+// Снимает с головы очереди n отправленных байт
+static void WriterAdvance(struct FrameWriter *writer, size_t n) {
+    writer->stats->bytes_out += n;
+    writer->pending -= n;
+
+    while (n > 0) {
+        struct WriterBlock *block = writer->head;
+        size_t left = block->len - block->pos;
+        if (n < left) {
+            block->pos += n;
+            break;
+        }
+        n -= left;
+        writer->head = block->next;
+        if (writer->head == NULL)
+            writer->tail = NULL;
+        if (writer->spare == NULL)
+            writer->spare = block;
+        else
+            free(block);
+    }
+}
+
+// Копирует очередь в кольцо и один раз будит собеседника. Если кольцо
+// заполнилось, ShmSend попросит разбудить нас, когда место появится
+static int WriterFlushShm(struct FrameWriter *writer) {
+    size_t sent = 0;
+    while (writer->pending > 0) {
+        struct WriterBlock *block = writer->head;
+        size_t n = ShmSend(writer->shm, block->data + block->pos, block->len - block->pos);
+        if (n == 0)
+            break;
+        WriterAdvance(writer, n);
+        sent += n;
+    }
+    if (sent > 0) {
+        ShmNotify(writer->shm);
+        writer->stats->write_calls++;
+    }
+    return writer->pending == 0 ? 1 : 0;
+}
+
+int WriterFlush(struct FrameWriter *writer) {
+    if (writer->shm != NULL)
+        return WriterFlushShm(writer);
+
+    while (writer->pending > 0) {
+        struct iovec iov[WRITER_MAX_IOV];
+        int iov_num = 0;
+        for (struct WriterBlock *block = writer->head;
+             block != NULL && iov_num < WRITER_MAX_IOV; block = block->next) {
+            if (block->len == block->pos)
+                continue;
+            iov[iov_num].iov_base = block->data + block->pos;
+            iov[iov_num].iov_len = block->len - block->pos;
+            iov_num++;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_num;
+
+        // sendmsg вместо writev ради MSG_NOSIGNAL: закрытый клиентом
+        // сокет не должен убивать процесс сигналом SIGPIPE
+        ssize_t n = sendmsg(writer->fd, &msg, MSG_NOSIGNAL);
+        writer->stats->write_calls++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        WriterAdvance(writer, (size_t)n);
+    }
+    return 1;
+}
@@ -2,15 +2,209 @@
 #define COMMON_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-// Структура для передачи данных о диапазоне вычислений
+// Структура для передачи данных о диапазоне вычислений.
+// type - ядро свёртки (enum TaskType из kernel.h), 0 - факториал
 struct FactorialArgs {
     uint64_t begin;
     uint64_t end;
     uint64_t mod;
+    uint32_t type;
 };
 
+// Протокол обмена клиента и сервера.
+// Кадр: заголовок FRAME_HEADER_SIZE байт, затем count записей.
+// Клиент отправляет кадр MSG_TASKS с задачами, сервер отвечает кадрами
+// MSG_RESULTS. Ответы могут приходить в любом порядке, клиент
+// сопоставляет их с задачами по id. Числа передаются в порядке байт хоста.
+#define PROTO_MAGIC 0x4c36
+#define PROTO_VERSION 4
+
+#define FRAME_HEADER_SIZE 8
+#define TASK_MSG_SIZE 48
+#define RESULT_MSG_SIZE 40
+#define MAX_FRAME_TASKS 4096
+#define MAX_STATS_SIZE 65536
+
+// MSG_STATS_REQUEST не несёт записей; в ответном кадре MSG_STATS
+// count - длина следующего за заголовком текста со статистикой
+enum MsgType {
+    MSG_TASKS = 1,
+    MSG_RESULTS = 2,
+    MSG_STATS_REQUEST = 3,
+    MSG_STATS = 4,
+};
+
+enum TaskStatus {
+    STATUS_OK = 0,
+    STATUS_INVALID = 1,
+    STATUS_ERROR = 2,
+    // Задача не успела к дедлайну и была остановлена
+    STATUS_EXPIRED = 3,
+    // Сервер перегружен и задачу не принял; value - через сколько
+    // миллисекунд стоит повторить (или отдать задачу другому серверу)
+    STATUS_BUSY = 4,
+};
+
+struct FrameHeader {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint32_t count;
+};
+
+// timeout_ms - сколько задача может пробыть на сервере с момента
+// получения, 0 - без ограничения. Тип задачи передаётся в args.type,
+// неизвестный тип сервер отклоняет с STATUS_INVALID. trace_id связывает
+// записи клиента и журнал сервера об одной задаче, 0 - без трассировки
+struct TaskMsg {
+    uint64_t id;
+    struct FactorialArgs args;
+    uint32_t timeout_ms;
+    uint64_t trace_id;
+};
+
+// queue_ns и compute_ns - сколько задача ждала на сервере и сколько
+// считалась (для STATUS_OK, иначе 0)
+struct ResultMsg {
+    uint64_t id;
+    uint32_t status;
+    uint64_t value;
+    uint64_t queue_ns;
+    uint64_t compute_ns;
+};
+
+void PutFrameHeader(char *buf, uint8_t type, uint32_t count);
+// Возвращает false при неверной сигнатуре, версии или размере кадра
+bool GetFrameHeader(const char *buf, struct FrameHeader *header);
+
+void PutTask(char *buf, const struct TaskMsg *task);
+void GetTask(const char *buf, struct TaskMsg *task);
+
+void PutResult(char *buf, const struct ResultMsg *result);
+void GetResult(const char *buf, struct ResultMsg *result);
+
+// Буферизованный ввод-вывод кадров поверх сокета. Работает и с
+// блокирующими, и с неблокирующими дескрипторами: короткие чтения
+// и записи докручиваются, а исходящие данные копятся в цепочке
+// блоков и уходят одним writev. Вместо сокета можно подключить кольца
+// общей памяти (поле shm, см. transport.h): кадры при этом не меняются.
+#define WRITER_BLOCK_SIZE 4096
+#define WRITER_MAX_IOV 64
+
+// Счётчики системных вызовов, по ним считается стоимость запроса
+struct IoStats {
+    uint64_t read_calls;
+    uint64_t write_calls;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+};
+
+struct ShmChannel;
+
+struct FrameReader {
+    int fd;
+    struct ShmChannel *shm;  // NULL - читаем из сокета fd
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    struct IoStats *stats;
+};
+
+struct WriterBlock {
+    struct WriterBlock *next;
+    size_t pos;
+    size_t len;
+    char data[WRITER_BLOCK_SIZE];
+};
+
+struct FrameWriter {
+    int fd;
+    struct ShmChannel *shm;  // NULL - пишем в сокет fd
+    struct WriterBlock *head;
+    struct WriterBlock *tail;
+    struct WriterBlock *spare;
+    size_t pending;
+    struct IoStats *stats;
+};
+
+bool ReaderInit(struct FrameReader *reader, int fd, size_t cap, struct IoStats *stats);
+void ReaderDestroy(struct FrameReader *reader);
+
+// Один recv в свободное место буфера. Возвращает число прочитанных
+// байт, 0 при закрытии соединения и -1 при ошибке (errno сохраняется)
+long ReaderFill(struct FrameReader *reader);
+
+// Блокирующее ожидание, пока в буфере не окажется хотя бы len байт
+bool ReaderNeed(struct FrameReader *reader, size_t len);
+
+static inline size_t ReaderAvailable(const struct FrameReader *reader) {
+    return reader->end - reader->start;
+}
+
+static inline const char *ReaderPeek(const struct FrameReader *reader) {
+    return reader->buf + reader->start;
+}
+
+static inline void ReaderConsume(struct FrameReader *reader, size_t len) {
+    reader->start += len;
+    if (reader->start == reader->end)
+        reader->start = reader->end = 0;
+}
+
+static inline bool ReaderFull(const struct FrameReader *reader) {
+    return reader->start == 0 && reader->end == reader->cap;
+}
+
+void WriterInit(struct FrameWriter *writer, int fd, struct IoStats *stats);
+void WriterDestroy(struct FrameWriter *writer);
+
+// Непрерывный участок из len байт (len <= WRITER_BLOCK_SIZE) в конце
+// очереди, в который можно сразу закодировать запись
+char *WriterReserve(struct FrameWriter *writer, size_t len);
+bool WriterAppend(struct FrameWriter *writer, const void *data, size_t len);
+
+// Отправляет накопленное через writev. Возвращает 1, если всё
+// отправлено, 0, если сокет заполнен (EAGAIN), и -1 при ошибке
+int WriterFlush(struct FrameWriter *writer);
+
+static inline bool WriterPending(const struct FrameWriter *writer) {
+    return writer->pending > 0;
+}
+
+// Монотонное время в наносекундах
+uint64_t NowNs(void);
+
+// Свёртка диапазона [begin, end] ядром args->type (по умолчанию -
+// произведение чисел по модулю). Тип должен быть известен (KernelGet)
+uint64_t Factorial(const struct FactorialArgs *args);
+
+// Условия досрочной остановки счёта: дедлайн по NowNs (0 - нет)
+// и флаг отмены, который выставляет другой поток (NULL - нет)
+struct FactorialCancel {
+    uint64_t deadline_ns;
+    const bool *cancelled;
+};
+
+enum FactorialStop {
+    FACTORIAL_DONE = 0,
+    FACTORIAL_EXPIRED = 1,
+    FACTORIAL_CANCELLED = 2,
+};
+
+// Столько умножений делается между проверками условий остановки
+#define FACTORIAL_CHUNK 65536
+
+// То же, что Factorial, но перед каждым куском из FACTORIAL_CHUNK
+// чисел проверяет cancel. Ядро ищется один раз на вызов, а не на число.
+// При остановке *result не определён
+enum FactorialStop FactorialChecked(const struct FactorialArgs *args,
+                                    const struct FactorialCancel *cancel,
+                                    uint64_t *result);
+
 // Функция модульного умножения
 uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod);
 
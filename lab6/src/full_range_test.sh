@@ -0,0 +1,107 @@
+#!/bin/bash
+# Проверка полного диапазона [0, UINT64_MAX]: в нём 2^64 чисел, и
+# end - begin + 1 переполняется в 0. Серверу с каждым планировщиком
+# (adaptive и fixed) отправляется один кадр MSG_TASKS с такой задачей
+# для каждого ядра. Ответ должен прийти со статусом STATUS_INVALID, а
+# сервер - остаться живым и ответить обычному клиенту.
+#
+# Затем клиент получает --k UINT64_MAX: он должен разрезать запрос на
+# задачи и начать счёт (досчитать его нельзя, поэтому клиент снимается
+# по таймауту), а не упасть при делении на части.
+#
+# Использование: ./full_range_test.sh [порт]
+
+port=${1:-20104}
+status_invalid=1
+kernels="0 1 2 3 4"
+
+if [ ! -x ./server ] || [ ! -x ./client ]; then
+    echo "Ошибка: сначала соберите server и client (make)" >&2
+    exit 1
+fi
+
+tmp=$(mktemp -d)
+server_pid=
+
+stop_server() {
+    kill "$server_pid" 2>/dev/null
+    wait "$server_pid" 2>/dev/null
+    server_pid=
+}
+
+cleanup() {
+    if [ -n "$server_pid" ]; then
+        stop_server
+    fi
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+# Кадр: заголовок (magic 0x4c36, версия 4, MSG_TASKS, одна задача),
+# затем задача: id 7, begin 0, end UINT64_MAX, mod 1000000007,
+# timeout 0, тип $1, trace_id 0. Всё в little-endian, 56 байт
+send_frame() {
+    printf '\x36\x4c\x04\x01\x01\x00\x00\x00'
+    printf '\x07\x00\x00\x00\x00\x00\x00\x00'
+    printf '\x00\x00\x00\x00\x00\x00\x00\x00'
+    printf '\xff\xff\xff\xff\xff\xff\xff\xff'
+    printf '\x07\xca\x9a\x3b\x00\x00\x00\x00'
+    printf '\x00\x00\x00\x00'
+    printf "\\x0$1\\x00\\x00\\x00"
+    printf '\x00\x00\x00\x00\x00\x00\x00\x00'
+}
+
+# Статус из ответа: заголовок 8 байт, затем id 8 байт и status
+task_status() {
+    exec 3<>"/dev/tcp/127.0.0.1/$port" || return 1
+    send_frame "$1" >&3
+    timeout 5 head -c 48 <&3 > "$tmp/reply.bin"
+    exec 3>&-
+    [ "$(stat -c %s "$tmp/reply.bin")" -eq 48 ] || return 1
+    od -An -tu4 -j16 -N4 "$tmp/reply.bin" | tr -d ' '
+}
+
+echo "127.0.0.1:$port" > "$tmp/servers.txt"
+failed=0
+for plan in adaptive fixed; do
+    ./server --port "$port" --tnum 2 --plan "$plan" --log-level error &
+    server_pid=$!
+    sleep 0.5
+
+    for type in $kernels; do
+        status=$(task_status "$type")
+        if [ "$status" != "$status_invalid" ]; then
+            echo "Ошибка: plan $plan, тип $type: статус ${status:-(нет ответа)}" >&2
+            failed=1
+        fi
+    done
+
+    if ! kill -0 "$server_pid" 2>/dev/null; then
+        echo "Ошибка: plan $plan: сервер упал" >&2
+        failed=1
+    elif ! timeout 10 ./client --k 10 --mod 1000000007 --servers "$tmp/servers.txt" \
+            --log-level off | grep -q "Results match: YES"; then
+        echo "Ошибка: plan $plan: сервер не отвечает после полного диапазона" >&2
+        failed=1
+    else
+        echo "plan $plan: OK"
+    fi
+    stop_server
+done
+
+./server --port "$port" --tnum 2 --log-level error &
+server_pid=$!
+sleep 0.5
+timeout 3 ./client --k 18446744073709551615 --mod 1000000007 --servers "$tmp/servers.txt" \
+    --log-level off > /dev/null 2>&1
+code=$?
+# 124 - клиент ещё считал, когда его снял timeout
+if [ "$code" -ne 124 ]; then
+    echo "Ошибка: client --k UINT64_MAX: код выхода $code" >&2
+    failed=1
+else
+    echo "client --k UINT64_MAX: OK"
+fi
+stop_server
+
+exit $failed
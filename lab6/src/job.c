@@ -0,0 +1,152 @@
+#include "job.h"
+
+#include <stdlib.h>
+
+static void JobCombine(struct FactorialJob *job) {
+    job->total = job->kernel->identity;
+    if (job->stop != FACTORIAL_DONE)
+        return;
+    for (int i = 0; i < job->parts_num; i++)
+        job->total = job->kernel->combine(job->total, job->results[i], job->args.mod);
+}
+
+static void JobPartRun(void *arg) {
+    struct JobPart *part = (struct JobPart *)arg;
+    struct FactorialJob *job = part->job;
+
+    uint64_t start = NowNs();
+    uint64_t unset = 0;
+    __atomic_compare_exchange_n(&job->start_ns, &unset, start, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    // Если другая часть уже остановилась, считать эту незачем
+    int stop = __atomic_load_n(&job->stop, __ATOMIC_RELAXED);
+    if (stop == FACTORIAL_DONE)
+        stop = FactorialChecked(&part->args, &job->cancel, part->slot);
+    if (stop != FACTORIAL_DONE) {
+        int done = FACTORIAL_DONE;
+        __atomic_compare_exchange_n(&job->stop, &done, stop, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    bool last = --job->pending == 0;
+    if (last)
+        job->done_ns = NowNs();
+    JobDoneFn on_done = job->on_done;
+    if (last && on_done == NULL)
+        pthread_cond_signal(&job->done);
+    pthread_mutex_unlock(&job->lock);
+
+    if (last && on_done != NULL) {
+        JobCombine(job);
+        on_done(job);
+    }
+}
+
+bool JobInit(struct FactorialJob *job, int max_parts) {
+    job->parts = malloc(max_parts * sizeof(struct JobPart));
+    job->results = malloc(max_parts * sizeof(uint64_t));
+    if (job->parts == NULL || job->results == NULL) {
+        free(job->parts);
+        free(job->results);
+        return false;
+    }
+
+    job->max_parts = max_parts;
+    job->parts_num = 0;
+    job->pending = 0;
+    job->on_done = NULL;
+    job->ctx = NULL;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->done, NULL);
+    return true;
+}
+
+void JobDestroy(struct FactorialJob *job) {
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->done);
+    free(job->parts);
+    free(job->results);
+}
+
+bool JobStart(struct FactorialJob *job, struct ThreadPool *pool,
+              const struct FactorialArgs *args, int parts_num,
+              const struct FactorialCancel *cancel, JobDoneFn on_done, void *ctx) {
+    // Пустой диапазон делить не на что, а в полном [0, UINT64_MAX]
+    // 2^64 чисел: end - begin + 1 обнулится и деление ниже упадёт
+    if (args->end < args->begin || args->end - args->begin == UINT64_MAX)
+        return false;
+    uint64_t numbers_count = args->end - args->begin + 1;
+
+    // Частей не больше, чем чисел в диапазоне: иначе получатся
+    // пустые поддиапазоны с end < begin
+    if (parts_num <= 0 || parts_num > job->max_parts)
+        parts_num = job->max_parts;
+    if ((uint64_t)parts_num > numbers_count)
+        parts_num = (int)numbers_count;
+
+    uint64_t numbers_per_part = numbers_count / parts_num;
+    uint64_t remainder = numbers_count % parts_num;
+    uint64_t current = args->begin;
+
+    job->args = *args;
+    job->kernel = KernelGet(args->type);
+    job->on_done = on_done;
+    job->ctx = ctx;
+    job->parts_num = parts_num;
+    job->pending = parts_num;
+    job->submit_ns = NowNs();
+    job->start_ns = 0;
+    job->done_ns = 0;
+    job->stop = FACTORIAL_DONE;
+    if (cancel != NULL) {
+        job->cancel = *cancel;
+    } else {
+        job->cancel.deadline_ns = 0;
+        job->cancel.cancelled = NULL;
+    }
+
+    for (int i = 0; i < parts_num; i++) {
+        struct JobPart *part = &job->parts[i];
+        part->job = job;
+        part->slot = &job->results[i];
+        part->args.begin = current;
+        part->args.end = current + numbers_per_part - 1;
+        if ((uint64_t)i < remainder)
+            part->args.end++;
+        part->args.mod = args->mod;
+        part->args.type = args->type;
+        current = part->args.end + 1;
+    }
+
+    for (int i = 0; i < parts_num; i++) {
+        if (!PoolSubmit(pool, JobPartRun, &job->parts[i])) {
+            // Ждём уже отправленные части, прежде чем вернуть ошибку
+            pthread_mutex_lock(&job->lock);
+            job->on_done = NULL;
+            job->pending -= parts_num - i;
+            while (job->pending > 0)
+                pthread_cond_wait(&job->done, &job->lock);
+            pthread_mutex_unlock(&job->lock);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool JobRun(struct FactorialJob *job, struct ThreadPool *pool,
+            const struct FactorialArgs *args, uint64_t *total) {
+    if (!JobStart(job, pool, args, 0, NULL, NULL, NULL))
+        return false;
+
+    pthread_mutex_lock(&job->lock);
+    while (job->pending > 0)
+        pthread_cond_wait(&job->done, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+
+    JobCombine(job);
+    *total = job->total;
+    return true;
+}
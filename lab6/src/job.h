@@ -0,0 +1,70 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "kernel.h"
+#include "pool.h"
+
+struct FactorialJob;
+
+// Поддиапазон запроса - одна задача для пула
+struct JobPart {
+    struct FactorialJob *job;
+    struct FactorialArgs args;
+    uint64_t *slot;
+};
+
+// Вызывается рабочим потоком, завершившим последнюю часть запроса
+typedef void (*JobDoneFn)(struct FactorialJob *job);
+
+// Запрос клиента, разбитый на части. Массивы частей и результатов
+// выделяются один раз и переиспользуются между запросами.
+struct FactorialJob {
+    int max_parts;
+    int parts_num;
+    struct JobPart *parts;
+    uint64_t *results;
+    struct FactorialArgs args;
+    const struct Kernel *kernel;  // ядро args.type, ищется один раз в JobStart
+    uint64_t total;
+
+    // Моменты постановки в пул, начала первой части и конца последней
+    uint64_t submit_ns;
+    uint64_t start_ns;
+    uint64_t done_ns;
+
+    JobDoneFn on_done;
+    void *ctx;
+
+    // Условия досрочной остановки и причина остановки (FactorialStop).
+    // Если stop != FACTORIAL_DONE, total не определён
+    struct FactorialCancel cancel;
+    int stop;
+
+    int pending;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+bool JobInit(struct FactorialJob *job, int max_parts);
+void JobDestroy(struct FactorialJob *job);
+
+// Делит диапазон на части и отдаёт их пулу, не дожидаясь результата.
+// Итог будет в job->total к моменту вызова on_done. Частей не больше
+// parts_num (0 - max_parts). cancel может быть NULL; иначе части
+// проверяют его на границах кусков и останавливаются. Тип задачи
+// args->type должен быть известен (KernelGet). Для пустого диапазона
+// и для полного [0, UINT64_MAX] возвращает false, ничего не начав.
+bool JobStart(struct FactorialJob *job, struct ThreadPool *pool,
+              const struct FactorialArgs *args, int parts_num,
+              const struct FactorialCancel *cancel, JobDoneFn on_done, void *ctx);
+
+// Делит диапазон на части, отдаёт их пулу и ждёт результата
+bool JobRun(struct FactorialJob *job, struct ThreadPool *pool,
+            const struct FactorialArgs *args, uint64_t *total);
+
+#endif
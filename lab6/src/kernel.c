@@ -0,0 +1,104 @@
+#include "kernel.h"
+
+#include <string.h>
+
+#include "common.h"
+
+// Сложение по модулю без переполнения при mod около UINT64_MAX
+static uint64_t AddModulo(uint64_t a, uint64_t b, uint64_t mod) {
+    a %= mod;
+    b %= mod;
+    return a >= mod - b ? a - (mod - b) : a + b;
+}
+
+static uint64_t MinOf(uint64_t a, uint64_t b, uint64_t mod) {
+    (void)mod;
+    return a < b ? a : b;
+}
+
+static uint64_t MaxOf(uint64_t a, uint64_t b, uint64_t mod) {
+    (void)mod;
+    return a > b ? a : b;
+}
+
+// splitmix64: дёшево и без состояния, элемент зависит только от i
+uint64_t KernelElement(uint64_t i, uint64_t mod) {
+    uint64_t z = i + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (z ^ (z >> 31)) % mod;
+}
+
+// Циклы идут до i == end включительно: end может быть UINT64_MAX
+
+static uint64_t RangeFactorial(uint64_t acc, uint64_t begin, uint64_t end, uint64_t mod) {
+    for (uint64_t i = begin;; i++) {
+        acc = MultModulo(acc, i, mod);
+        if (i == end)
+            break;
+    }
+    return acc;
+}
+
+static uint64_t RangeSum(uint64_t acc, uint64_t begin, uint64_t end, uint64_t mod) {
+    for (uint64_t i = begin;; i++) {
+        acc = AddModulo(acc, i, mod);
+        if (i == end)
+            break;
+    }
+    return acc;
+}
+
+static uint64_t RangeProduct(uint64_t acc, uint64_t begin, uint64_t end, uint64_t mod) {
+    for (uint64_t i = begin;; i++) {
+        acc = MultModulo(acc, KernelElement(i, mod), mod);
+        if (i == end)
+            break;
+    }
+    return acc;
+}
+
+static uint64_t RangeMin(uint64_t acc, uint64_t begin, uint64_t end, uint64_t mod) {
+    for (uint64_t i = begin;; i++) {
+        uint64_t x = KernelElement(i, mod);
+        if (x < acc)
+            acc = x;
+        if (i == end)
+            break;
+    }
+    return acc;
+}
+
+static uint64_t RangeMax(uint64_t acc, uint64_t begin, uint64_t end, uint64_t mod) {
+    for (uint64_t i = begin;; i++) {
+        uint64_t x = KernelElement(i, mod);
+        if (x > acc)
+            acc = x;
+        if (i == end)
+            break;
+    }
+    return acc;
+}
+
+// Порядок совпадает с enum TaskType
+static const struct Kernel kernels[TASK_TYPES] = {
+    {"factorial", 1, RangeFactorial, MultModulo, KERNEL_COST_END_BITS},
+    {"sum", 0, RangeSum, AddModulo, KERNEL_COST_FLAT},
+    {"product", 1, RangeProduct, MultModulo, KERNEL_COST_MOD_BITS},
+    {"min", UINT64_MAX, RangeMin, MinOf, KERNEL_COST_FLAT},
+    {"max", 0, RangeMax, MaxOf, KERNEL_COST_FLAT},
+};
+
+const struct Kernel *KernelGet(uint32_t type) {
+    return type < TASK_TYPES ? &kernels[type] : NULL;
+}
+
+bool KernelParse(const char *name, uint32_t *type) {
+    for (uint32_t i = 0; i < TASK_TYPES; i++) {
+        if (strcmp(kernels[i].name, name) == 0) {
+            *type = i;
+            return true;
+        }
+    }
+    return false;
+}
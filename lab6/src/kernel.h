@@ -0,0 +1,54 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Реестр ядер свёртки диапазона. Задача любого типа - это свёртка
+// f(begin) op ... op f(end) по модулю mod ассоциативной операцией op,
+// поэтому её, как и факториал, можно резать на части и собирать
+// результаты частей в любом порядке.
+//
+// Тип задачи - индекс в таблице ядер. Ядро ищется один раз на вызов
+// FactorialChecked, дальше на кусок из FACTORIAL_CHUNK чисел приходится
+// один косвенный вызов: внутренний цикл у каждого ядра свой и
+// обходится без косвенных вызовов на каждое число.
+
+enum TaskType {
+    TASK_FACTORIAL = 0,  // произведение i
+    TASK_SUM = 1,        // сумма i
+    TASK_PRODUCT = 2,    // произведение элементов сгенерированного массива
+    TASK_MIN = 3,        // минимум сгенерированного массива
+    TASK_MAX = 4,        // максимум сгенерированного массива
+    TASK_TYPES
+};
+
+// От чего зависит цена одного числа, нужно планировщику сервера
+enum KernelCost {
+    KERNEL_COST_FLAT,      // не зависит от чисел
+    KERNEL_COST_END_BITS,  // MultModulo на множитель i: по шагу на бит end
+    KERNEL_COST_MOD_BITS,  // MultModulo на элемент массива: по шагу на бит mod
+};
+
+struct Kernel {
+    const char *name;
+    // Нейтральный элемент op
+    uint64_t identity;
+    // acc op f(begin) op ... op f(end), begin <= end
+    uint64_t (*range)(uint64_t acc, uint64_t begin, uint64_t end, uint64_t mod);
+    // a op b: так собираются результаты частей на сервере и задач на клиенте
+    uint64_t (*combine)(uint64_t a, uint64_t b, uint64_t mod);
+    enum KernelCost cost;
+};
+
+// Ядро по типу из протокола, NULL для неизвестного типа
+const struct Kernel *KernelGet(uint32_t type);
+
+// Тип по имени ядра (factorial, sum, product, min, max)
+bool KernelParse(const char *name, uint32_t *type);
+
+// i-й элемент сгенерированного массива: псевдослучайное число
+// из [0, mod), одно и то же на клиенте и на всех серверах
+uint64_t KernelElement(uint64_t i, uint64_t mod);
+
+#endif
@@ -0,0 +1,551 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "kernel.h"
+#include "metrics.h"
+#include "transport.h"
+
+// Генератор нагрузки для сервера факториалов.
+// closed: N соединений, на каждом всегда M запросов в полёте, новый
+//   запрос уходит сразу после ответа.
+// open: запросы уходят с фиксированной частотой независимо от ответов.
+// Задержка в open считается от запланированного времени отправки,
+// а не от фактического, поэтому медленный сервер не прячет очередь
+// (coordinated omission). В closed та же поправка делается после
+// прогона через HistCorrect.
+
+// Сервер может ответить на все задачи соединения одним кадром
+#define LOADGEN_READ_SIZE (FRAME_HEADER_SIZE + MAX_FRAME_TASKS * RESULT_MSG_SIZE)
+#define MAX_MODS 16
+// Сколько ждать ответов на отправленное после окончания прогона
+#define DRAIN_NS 2000000000ULL
+
+enum Mode { MODE_CLOSED, MODE_OPEN };
+
+enum Dist { DIST_FIXED, DIST_UNIFORM, DIST_EXP };
+
+struct RangeDist {
+    enum Dist type;
+    uint64_t a;
+    uint64_t b;
+};
+
+struct Request {
+    uint64_t intended_ns;  // когда запрос должен был уйти
+    uint64_t sent_ns;
+    bool busy;
+    int next_free;
+};
+
+struct LoadConn {
+    int fd;
+    uint32_t events;
+    int inflight;
+    struct FrameReader reader;
+    struct FrameWriter writer;
+    uint32_t batched;     // задач в незакрытом кадре
+    char *batch_header;   // заголовок этого кадра в буфере writer
+    struct ShmChannel shm;
+};
+
+struct LoadGen {
+    enum Mode mode;
+    int conns_num;
+    int inflight;
+    double rate;
+    struct RangeDist dist;
+    uint64_t mods[MAX_MODS];
+    int mods_num;
+    uint64_t rng;
+    uint32_t deadline_ms;
+    uint32_t task_type;
+
+    int epoll_fd;
+    struct LoadConn *conns;
+    struct IoStats stats;
+    int next_conn;
+
+    struct Request *requests;
+    int requests_cap;
+    int free_head;
+
+    uint64_t sent;
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t expired;  // из errors: остановлены сервером по дедлайну
+    uint64_t busy;     // отклонены перегруженным сервером, в задержку не входят
+    uint64_t start_ns;
+    uint64_t last_reply_ns;
+    struct Histogram raw_ns;       // от фактической отправки
+    struct Histogram intended_ns;  // от запланированной отправки
+};
+
+// xorshift64*: быстрый генератор, качества для нагрузки достаточно
+static uint64_t Rand(struct LoadGen *gen) {
+    gen->rng ^= gen->rng >> 12;
+    gen->rng ^= gen->rng << 25;
+    gen->rng ^= gen->rng >> 27;
+    return gen->rng * 2685821657736338717ULL;
+}
+
+static double RandUnit(struct LoadGen *gen) {
+    return (Rand(gen) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t RangeLength(struct LoadGen *gen) {
+    switch (gen->dist.type) {
+    case DIST_UNIFORM:
+        return gen->dist.a + Rand(gen) % (gen->dist.b - gen->dist.a + 1);
+    case DIST_EXP: {
+        double u = RandUnit(gen);
+        uint64_t len = (uint64_t)(-log(1.0 - u) * gen->dist.a);
+        return len ? len : 1;
+    }
+    default:
+        return gen->dist.a;
+    }
+}
+
+// "fixed:N", "uniform:A:B" или "exp:MEAN" - длина диапазона задачи
+static bool ParseDist(const char *str, struct RangeDist *dist) {
+    char type[16];
+    unsigned long long a = 0, b = 0;
+    int n = sscanf(str, "%15[a-z]:%llu:%llu", type, &a, &b);
+    if (n >= 2 && strcmp(type, "fixed") == 0 && a > 0) {
+        dist->type = DIST_FIXED;
+    } else if (n == 3 && strcmp(type, "uniform") == 0 && a > 0 && b >= a) {
+        dist->type = DIST_UNIFORM;
+    } else if (n >= 2 && strcmp(type, "exp") == 0 && a > 0) {
+        dist->type = DIST_EXP;
+    } else {
+        return false;
+    }
+    dist->a = a;
+    dist->b = b;
+    return true;
+}
+
+static int ParseMods(const char *str, uint64_t *mods) {
+    int n = 0;
+    char *copy = strdup(str);
+    for (char *tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n == MAX_MODS || !ConvertStringToUI64(tok, &mods[n]) || mods[n] == 0) {
+            free(copy);
+            return -1;
+        }
+        n++;
+    }
+    free(copy);
+    return n;
+}
+
+// Подключается и подписывает соединение на события. Для shm ждёт
+// сегмент от сервера и дальше просыпается по его eventfd
+static bool ConnectTo(struct LoadGen *gen, struct LoadConn *conn, const struct TransportAddr *addr) {
+    conn->fd = socket(addr->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn->fd < 0)
+        return false;
+    if (connect(conn->fd, (const struct sockaddr *)&addr->addr, addr->addr_len) < 0 &&
+        errno != EINPROGRESS)
+        return false;
+    if (!ReaderInit(&conn->reader, conn->fd, LOADGEN_READ_SIZE, &gen->stats))
+        return false;
+    WriterInit(&conn->writer, conn->fd, &gen->stats);
+
+    struct epoll_event ev;
+    ev.data.ptr = conn;
+    if (addr->type != TRANSPORT_SHM) {
+        ev.events = conn->events = EPOLLIN;
+        return epoll_ctl(gen->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) == 0;
+    }
+
+    if (!ShmConnect(&conn->shm, conn->fd, 3000))
+        return false;
+    conn->reader.shm = conn->writer.shm = &conn->shm;
+    ev.events = conn->events = EPOLLRDHUP;
+    if (epoll_ctl(gen->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0)
+        return false;
+    ev.events = EPOLLIN;
+    return epoll_ctl(gen->epoll_fd, EPOLL_CTL_ADD, conn->shm.wake_fd, &ev) == 0;
+}
+
+static int RequestAlloc(struct LoadGen *gen) {
+    if (gen->free_head < 0) {
+        int cap = gen->requests_cap ? gen->requests_cap * 2 : 1024;
+        struct Request *grown = realloc(gen->requests, cap * sizeof(struct Request));
+        if (grown == NULL)
+            return -1;
+        for (int i = gen->requests_cap; i < cap; i++)
+            grown[i].next_free = i + 1 < cap ? i + 1 : -1;
+        gen->requests = grown;
+        gen->free_head = gen->requests_cap;
+        gen->requests_cap = cap;
+    }
+    int id = gen->free_head;
+    gen->free_head = gen->requests[id].next_free;
+    gen->requests[id].busy = true;
+    return id;
+}
+
+static void RequestFree(struct LoadGen *gen, int id) {
+    gen->requests[id].busy = false;
+    gen->requests[id].next_free = gen->free_head;
+    gen->free_head = id;
+}
+
+// Добавляет задачу в текущий кадр соединения. Задачи, выпущенные
+// за один проход цикла, уходят одним кадром
+static bool Issue(struct LoadGen *gen, struct LoadConn *conn, uint64_t intended_ns) {
+    int id = RequestAlloc(gen);
+    if (id < 0)
+        return false;
+
+    if (conn->batch_header == NULL || conn->batched == MAX_FRAME_TASKS) {
+        conn->batch_header = WriterReserve(&conn->writer, FRAME_HEADER_SIZE);
+        conn->batched = 0;
+        if (conn->batch_header == NULL)
+            return false;
+    }
+
+    struct TaskMsg task;
+    task.id = (uint64_t)id;
+    task.args.begin = 1 + Rand(gen) % 1000000;
+    task.args.end = task.args.begin + RangeLength(gen) - 1;
+    task.args.mod = gen->mods[Rand(gen) % gen->mods_num];
+    task.args.type = gen->task_type;
+    task.timeout_ms = gen->deadline_ms;
+    task.trace_id = 0;
+    char *buf = WriterReserve(&conn->writer, TASK_MSG_SIZE);
+    if (buf == NULL)
+        return false;
+    PutTask(buf, &task);
+    PutFrameHeader(conn->batch_header, MSG_TASKS, ++conn->batched);
+
+    gen->requests[id].intended_ns = intended_ns;
+    gen->requests[id].sent_ns = NowNs();
+    conn->inflight++;
+    gen->sent++;
+    return true;
+}
+
+static bool ConnFlush(struct LoadGen *gen, struct LoadConn *conn) {
+    conn->batch_header = NULL;
+    int rc = WriterFlush(&conn->writer);
+    if (rc < 0)
+        return false;
+    // Место в кольце shm освобождается с пробуждением от сервера
+    if (conn->writer.shm != NULL)
+        return true;
+    uint32_t events = EPOLLIN | (rc == 0 ? EPOLLOUT : 0);
+    if (events != conn->events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = conn;
+        epoll_ctl(gen->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = events;
+    }
+    return true;
+}
+
+static bool ConnRead(struct LoadGen *gen, struct LoadConn *conn, bool issuing) {
+    if (conn->reader.shm != NULL)
+        ShmDrainWake(conn->reader.shm);
+    long n = ReaderFill(&conn->reader);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        return false;
+    // В кольце осталось больше, чем влезло в буфер
+    if (conn->reader.shm != NULL && ShmReadable(conn->reader.shm))
+        ShmWakeSelf(conn->reader.shm);
+
+    struct FrameReader *reader = &conn->reader;
+    while (ReaderAvailable(reader) >= FRAME_HEADER_SIZE) {
+        struct FrameHeader header;
+        if (!GetFrameHeader(ReaderPeek(reader), &header) || header.type != MSG_RESULTS)
+            return false;
+        size_t frame_size = FRAME_HEADER_SIZE + (size_t)header.count * RESULT_MSG_SIZE;
+        if (ReaderAvailable(reader) < frame_size)
+            break;
+        ReaderConsume(reader, FRAME_HEADER_SIZE);
+
+        uint64_t now = NowNs();
+        for (uint32_t i = 0; i < header.count; i++) {
+            struct ResultMsg result;
+            GetResult(ReaderPeek(reader), &result);
+            ReaderConsume(reader, RESULT_MSG_SIZE);
+            if (result.id >= (uint64_t)gen->requests_cap || !gen->requests[result.id].busy)
+                return false;
+
+            // Отказ по перегрузке приходит сразу и не отражает задержку
+            // принятой работы, поэтому считается отдельно
+            struct Request *req = &gen->requests[result.id];
+            if (result.status == STATUS_BUSY) {
+                gen->busy++;
+            } else {
+                HistRecord(&gen->raw_ns, now - req->sent_ns);
+                HistRecord(&gen->intended_ns, now - req->intended_ns);
+            }
+            RequestFree(gen, (int)result.id);
+            conn->inflight--;
+            gen->completed++;
+            gen->last_reply_ns = now;
+            if (result.status != STATUS_OK && result.status != STATUS_BUSY)
+                gen->errors++;
+            if (result.status == STATUS_EXPIRED)
+                gen->expired++;
+
+            // closed: место освободилось - сразу следующий запрос
+            if (issuing && gen->mode == MODE_CLOSED && !Issue(gen, conn, now))
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool LoadRun(struct LoadGen *gen, const char *server, double duration) {
+    struct TransportAddr addr;
+    const char *error = TransportResolve(server, &addr);
+    if (error != NULL) {
+        fprintf(stderr, "Can not resolve %s: %s\n", server, error);
+        return false;
+    }
+
+    gen->epoll_fd = epoll_create1(0);
+    gen->conns = calloc(gen->conns_num, sizeof(struct LoadConn));
+    if (gen->epoll_fd < 0 || gen->conns == NULL)
+        return false;
+
+    for (int i = 0; i < gen->conns_num; i++) {
+        struct LoadConn *conn = &gen->conns[i];
+        if (!ConnectTo(gen, conn, &addr)) {
+            fprintf(stderr, "Can not connect to %s\n", server);
+            return false;
+        }
+    }
+
+    uint64_t start = gen->start_ns = NowNs();
+    uint64_t stop = start + (uint64_t)(duration * 1e9);
+    uint64_t interval = gen->mode == MODE_OPEN ? (uint64_t)(1e9 / gen->rate) : 0;
+    uint64_t next_send = start;
+
+    if (gen->mode == MODE_CLOSED) {
+        for (int i = 0; i < gen->conns_num; i++) {
+            for (int j = 0; j < gen->inflight; j++) {
+                if (!Issue(gen, &gen->conns[i], start))
+                    return false;
+            }
+        }
+    }
+
+    struct epoll_event events[64];
+    while (true) {
+        uint64_t now = NowNs();
+        bool issuing = now < stop;
+        if (!issuing && (gen->completed == gen->sent || now >= stop + DRAIN_NS))
+            break;
+
+        // open: догоняем расписание, даже если отстали - запросы,
+        // которые опоздали, всё равно считаются от своего времени
+        while (gen->mode == MODE_OPEN && issuing && next_send <= now) {
+            struct LoadConn *conn = &gen->conns[gen->next_conn];
+            gen->next_conn = (gen->next_conn + 1) % gen->conns_num;
+            if (!Issue(gen, conn, next_send))
+                return false;
+            next_send += interval;
+        }
+        for (int i = 0; i < gen->conns_num; i++) {
+            if (gen->conns[i].batch_header != NULL || WriterPending(&gen->conns[i].writer)) {
+                if (!ConnFlush(gen, &gen->conns[i]))
+                    return false;
+            }
+        }
+
+        int timeout_ms = 10;
+        if (gen->mode == MODE_OPEN && issuing)
+            timeout_ms = next_send > now ? (int)((next_send - now) / 1000000) : 0;
+        int n = epoll_wait(gen->epoll_fd, events, 64, timeout_ms);
+        if (n < 0 && errno != EINTR)
+            return false;
+        for (int i = 0; i < n; i++) {
+            struct LoadConn *conn = events[i].data.ptr;
+            if ((events[i].events & EPOLLRDHUP) ||
+                ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+                 !ConnRead(gen, conn, NowNs() < stop))) {
+                fprintf(stderr, "Connection to %s failed\n", server);
+                return false;
+            }
+        }
+    }
+
+    // Без ответа к концу ожидания: задержка не меньше прошедшего времени
+    uint64_t end = NowNs();
+    for (int i = 0; i < gen->requests_cap; i++) {
+        if (gen->requests[i].busy)
+            HistRecord(&gen->intended_ns, end - gen->requests[i].intended_ns);
+    }
+    return true;
+}
+
+static void PrintLatency(const char *name, const struct Histogram *hist) {
+    printf("%s latency ms: p50 %.3f, p99 %.3f, p999 %.3f, max %.3f\n", name,
+           HistPercentile(hist, 0.5) / 1e6, HistPercentile(hist, 0.99) / 1e6,
+           HistPercentile(hist, 0.999) / 1e6, hist->max / 1e6);
+}
+
+int main(int argc, char **argv) {
+    const char *server = NULL;
+    double duration = 5.0;
+    bool csv = false;
+    struct LoadGen *gen = calloc(1, sizeof(struct LoadGen));
+    if (gen == NULL)
+        return 1;
+    gen->mode = MODE_CLOSED;
+    gen->conns_num = 4;
+    gen->inflight = 8;
+    gen->dist.type = DIST_FIXED;
+    gen->dist.a = 1000;
+    gen->mods[0] = 1000000007;
+    gen->mods_num = 1;
+    gen->rng = 88172645463325252ULL;
+    gen->free_head = -1;
+
+    while (true) {
+        static struct option options[] = {{"server", required_argument, 0, 0},
+                                          {"mode", required_argument, 0, 0},
+                                          {"connections", required_argument, 0, 0},
+                                          {"inflight", required_argument, 0, 0},
+                                          {"rate", required_argument, 0, 0},
+                                          {"duration", required_argument, 0, 0},
+                                          {"range", required_argument, 0, 0},
+                                          {"mods", required_argument, 0, 0},
+                                          {"seed", required_argument, 0, 0},
+                                          {"csv", no_argument, 0, 0},
+                                          {"deadline", required_argument, 0, 0},
+                                          {"task", required_argument, 0, 0},
+                                          {0, 0, 0, 0}};
+
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "", options, &option_index);
+        if (c == -1)
+            break;
+        if (c != 0) {
+            server = NULL;
+            break;
+        }
+
+        bool ok = true;
+        switch (option_index) {
+        case 0:
+            server = optarg;
+            break;
+        case 1:
+            ok = strcmp(optarg, "closed") == 0 || strcmp(optarg, "open") == 0;
+            gen->mode = strcmp(optarg, "open") == 0 ? MODE_OPEN : MODE_CLOSED;
+            break;
+        case 2:
+            gen->conns_num = atoi(optarg);
+            ok = gen->conns_num > 0;
+            break;
+        case 3:
+            gen->inflight = atoi(optarg);
+            ok = gen->inflight > 0;
+            break;
+        case 4:
+            gen->rate = atof(optarg);
+            ok = gen->rate > 0;
+            break;
+        case 5:
+            duration = atof(optarg);
+            ok = duration > 0;
+            break;
+        case 6:
+            ok = ParseDist(optarg, &gen->dist);
+            break;
+        case 7:
+            gen->mods_num = ParseMods(optarg, gen->mods);
+            ok = gen->mods_num > 0;
+            break;
+        case 8:
+            ok = ConvertStringToUI64(optarg, &gen->rng) && gen->rng != 0;
+            break;
+        case 9:
+            csv = true;
+            break;
+        case 10: {
+            uint64_t deadline = 0;
+            ok = ConvertStringToUI64(optarg, &deadline) && deadline <= UINT32_MAX;
+            gen->deadline_ms = (uint32_t)deadline;
+        } break;
+        case 11:
+            ok = KernelParse(optarg, &gen->task_type);
+            break;
+        }
+        if (!ok) {
+            fprintf(stderr, "Invalid %s value: %s\n", options[option_index].name, optarg);
+            return 1;
+        }
+    }
+
+    if (server == NULL || (gen->mode == MODE_OPEN && gen->rate <= 0)) {
+        fprintf(stderr,
+                "Using: %s --server host:port|unix:/path|shm:name [--mode closed|open] [--connections 4]\n"
+                "       [--inflight 8] [--rate req_per_sec] [--duration 5]\n"
+                "       [--range fixed:N|uniform:A:B|exp:MEAN] [--mods m1,m2] [--seed N] [--csv]\n"
+                "       [--deadline ms] [--task factorial|sum|product|min|max]\n"
+                "open mode needs --rate\n",
+                argv[0]);
+        return 1;
+    }
+    if (!LoadRun(gen, server, duration))
+        return 1;
+
+    // Пропускная способность - по ответам, полученным до последнего
+    double seconds = (gen->last_reply_ns - gen->start_ns) / 1e9;
+    double qps = seconds > 0 ? (gen->completed - gen->busy) / seconds : 0;
+
+    // closed: ожидаемый интервал на слот - медиана задержки
+    struct Histogram corrected;
+    memset(&corrected, 0, sizeof(corrected));
+    if (gen->mode == MODE_CLOSED)
+        HistCorrect(&corrected, &gen->raw_ns, HistPercentile(&gen->raw_ns, 0.5));
+    else
+        HistMerge(&corrected, &gen->intended_ns);
+
+    uint64_t unfinished = gen->sent - gen->completed;
+    if (csv) {
+        printf("mode,connections,inflight,rate,range,sent,completed,errors,unfinished,qps,"
+               "p50_ms,p99_ms,p999_ms,max_ms,busy\n");
+        printf("%s,%d,%d,%.0f,%s:%lu:%lu,%lu,%lu,%lu,%lu,%.1f,%.3f,%.3f,%.3f,%.3f,%lu\n",
+               gen->mode == MODE_OPEN ? "open" : "closed", gen->conns_num,
+               gen->mode == MODE_CLOSED ? gen->inflight : 0, gen->rate,
+               gen->dist.type == DIST_FIXED ? "fixed" : gen->dist.type == DIST_UNIFORM ? "uniform" : "exp",
+               gen->dist.a, gen->dist.b, gen->sent, gen->completed, gen->errors, unfinished, qps,
+               HistPercentile(&corrected, 0.5) / 1e6, HistPercentile(&corrected, 0.99) / 1e6,
+               HistPercentile(&corrected, 0.999) / 1e6, corrected.max / 1e6, gen->busy);
+    } else {
+        if (gen->mode == MODE_OPEN)
+            printf("mode open, rate %.0f/s, connections %d, duration %.1f s\n",
+                   gen->rate, gen->conns_num, duration);
+        else
+            printf("mode closed, connections %d x inflight %d, duration %.1f s\n",
+                   gen->conns_num, gen->inflight, duration);
+        printf("sent %lu, completed %lu, busy %lu, errors %lu (expired %lu), unfinished %lu\n",
+               gen->sent, gen->completed, gen->busy, gen->errors, gen->expired, unfinished);
+        printf("achieved %.1f req/s (recv %lu, send %lu)\n",
+               qps, gen->stats.read_calls, gen->stats.write_calls);
+        PrintLatency("corrected", &corrected);
+        PrintLatency("raw", &gen->raw_ns);
+    }
+    return gen->errors == 0 && unfinished == 0 ? 0 : 1;
+}
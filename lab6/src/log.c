@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+
+#include "log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SLOTS 1024
+#define LOG_MSG_SIZE 240
+#define LOG_FLUSH_MS 5
+#define LOG_BATCH_SIZE 65536
+
+struct LogSlot {
+    uint8_t level;
+    uint16_t len;
+    char text[LOG_MSG_SIZE];
+};
+
+// Кольцо одного потока: единственный писатель (сам поток) двигает head,
+// единственный читатель (фоновый поток) двигает tail
+struct LogRing {
+    struct LogSlot slots[LOG_RING_SLOTS];
+    uint64_t head;
+    uint64_t tail;
+    struct LogRing *next;
+};
+
+int g_log_level = LOG_INFO;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct LogRing *rings_head;
+static __thread struct LogRing *thread_ring;
+
+static pthread_t flusher;
+static bool flusher_started;
+static int flusher_stop;
+static uint64_t dropped;
+static uint64_t dropped_reported;
+
+// Кольцо заводится при первой записи потока и живёт до LogShutdown,
+// поэтому сообщения завершившихся потоков тоже будут дописаны
+static struct LogRing *LogThreadRing(void) {
+    if (thread_ring != NULL)
+        return thread_ring;
+
+    struct LogRing *ring = calloc(1, sizeof(struct LogRing));
+    if (ring == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings_head;
+    rings_head = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    thread_ring = ring;
+    return ring;
+}
+
+void LogWrite(enum LogLevel level, const char *fmt, ...) {
+    struct LogRing *ring = LogThreadRing();
+    if (ring == NULL) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == LOG_RING_SLOTS) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct LogSlot *slot = &ring->slots[head % LOG_RING_SLOTS];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(slot->text, sizeof(slot->text), fmt, args);
+    va_end(args);
+    if (len < 0)
+        len = 0;
+    if (len >= (int)sizeof(slot->text))
+        len = sizeof(slot->text) - 1;
+
+    slot->level = (uint8_t)level;
+    slot->len = (uint16_t)len;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void WriteFull(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+struct LogBatch {
+    int fd;
+    size_t len;
+    char buf[LOG_BATCH_SIZE];
+};
+
+static void BatchAppend(struct LogBatch *batch, const char *prefix, const char *text, size_t len) {
+    size_t prefix_len = strlen(prefix);
+    if (batch->len + prefix_len + len + 1 > sizeof(batch->buf)) {
+        WriteFull(batch->fd, batch->buf, batch->len);
+        batch->len = 0;
+    }
+    memcpy(batch->buf + batch->len, prefix, prefix_len);
+    batch->len += prefix_len;
+    memcpy(batch->buf + batch->len, text, len);
+    batch->len += len;
+    batch->buf[batch->len++] = '\n';
+}
+
+// Выгребает все кольца. Вызывается только из фонового потока
+// или после его остановки
+static void LogDrain(struct LogBatch *out, struct LogBatch *err) {
+    pthread_mutex_lock(&rings_lock);
+    struct LogRing *ring = rings_head;
+    pthread_mutex_unlock(&rings_lock);
+
+    for (; ring != NULL; ring = ring->next) {
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        for (; tail != head; tail++) {
+            struct LogSlot *slot = &ring->slots[tail % LOG_RING_SLOTS];
+            char prefix[16];
+            snprintf(prefix, sizeof(prefix), "%s ", level_names[slot->level]);
+            BatchAppend(slot->level >= LOG_WARN ? err : out, prefix, slot->text, slot->len);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    uint64_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (lost != dropped_reported) {
+        char text[64];
+        int len = snprintf(text, sizeof(text), "%lu log messages dropped",
+                           (unsigned long)(lost - dropped_reported));
+        BatchAppend(err, "WARN ", text, len);
+        dropped_reported = lost;
+    }
+
+    WriteFull(out->fd, out->buf, out->len);
+    out->len = 0;
+    WriteFull(err->fd, err->buf, err->len);
+    err->len = 0;
+}
+
+static struct LogBatch batch_out = {STDOUT_FILENO, 0, {0}};
+static struct LogBatch batch_err = {STDERR_FILENO, 0, {0}};
+
+static void *LogFlusher(void *arg) {
+    (void)arg;
+    struct timespec interval = {0, LOG_FLUSH_MS * 1000000L};
+
+    while (!__atomic_load_n(&flusher_stop, __ATOMIC_ACQUIRE)) {
+        LogDrain(&batch_out, &batch_err);
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+bool LogInit(enum LogLevel level) {
+    __atomic_store_n(&g_log_level, level, __ATOMIC_RELAXED);
+    __atomic_store_n(&flusher_stop, 0, __ATOMIC_RELAXED);
+
+    // Печать вне журнала (итоговые результаты) не должна перемешиваться
+    // с пачками фонового потока из-за буфера stdio
+    fflush(stdout);
+
+    if (pthread_create(&flusher, NULL, LogFlusher, NULL) != 0)
+        return false;
+    flusher_started = true;
+    return true;
+}
+
+void LogFlush(void) {
+    if (flusher_started) {
+        __atomic_store_n(&flusher_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(flusher, NULL);
+        flusher_started = false;
+    }
+    LogDrain(&batch_out, &batch_err);
+}
+
+void LogShutdown(void) {
+    LogFlush();
+
+    pthread_mutex_lock(&rings_lock);
+    while (rings_head != NULL) {
+        struct LogRing *next = rings_head->next;
+        free(rings_head);
+        rings_head = next;
+    }
+    pthread_mutex_unlock(&rings_lock);
+    thread_ring = NULL;
+}
+
+bool LogParseLevel(const char *name, enum LogLevel *level) {
+    static const char *names[] = {"debug", "info", "warn", "error", "off"};
+    for (int i = 0; i <= LOG_OFF; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *level = (enum LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t LogDropped(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,56 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Асинхронный журнал. Каждый поток пишет в своё кольцо без блокировок,
+// фоновый поток раз в LOG_FLUSH_MS выгребает все кольца и пишет их
+// пачкой. Если кольцо заполнено, сообщение отбрасывается и учитывается
+// в счётчике потерь - вызывающий поток никогда не ждёт.
+enum LogLevel {
+    LOG_DEBUG = 0,
+    LOG_INFO = 1,
+    LOG_WARN = 2,
+    LOG_ERROR = 3,
+    LOG_OFF = 4,
+};
+
+extern int g_log_level;
+
+// Проверка уровня стоит до вычисления аргументов: при выключенном
+// уровне ни форматирования, ни обращения к кольцу нет
+#define LOG_ENABLED(level) ((int)(level) >= __atomic_load_n(&g_log_level, __ATOMIC_RELAXED))
+
+#define LOG(level, ...)                       \
+    do {                                      \
+        if (LOG_ENABLED(level))               \
+            LogWrite((level), __VA_ARGS__);   \
+    } while (0)
+
+#define LOG_D(...) LOG(LOG_DEBUG, __VA_ARGS__)
+#define LOG_I(...) LOG(LOG_INFO, __VA_ARGS__)
+#define LOG_W(...) LOG(LOG_WARN, __VA_ARGS__)
+#define LOG_E(...) LOG(LOG_ERROR, __VA_ARGS__)
+
+// Запускает фоновый поток записи. INFO и DEBUG уходят в stdout,
+// WARN и ERROR - в stderr
+bool LogInit(enum LogLevel level);
+
+// Останавливает фоновый поток и дописывает всё накопленное. Кольца
+// остаются: другие потоки могут писать дальше, но уже без вывода.
+// Для выхода, когда остальные потоки ещё работают
+void LogFlush(void);
+
+// LogFlush и освобождение колец. Вызывать, когда других пишущих
+// потоков уже нет: они держат указатель на своё кольцо
+void LogShutdown(void);
+
+void LogWrite(enum LogLevel level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+bool LogParseLevel(const char *name, enum LogLevel *level);
+
+uint64_t LogDropped(void);
+
+#endif
@@ -0,0 +1,744 @@
+#define _GNU_SOURCE
+
+#include "loop.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#define MAX_EVENTS 256
+
+static bool SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static struct Task *TaskAlloc(struct EventLoop *loop) {
+    struct Task *task = loop->task_free;
+    if (task != NULL) {
+        loop->task_free = task->next;
+        return task;
+    }
+
+    task = malloc(sizeof(struct Task));
+    if (task == NULL)
+        return NULL;
+    if (!JobInit(&task->job, loop->tnum)) {
+        free(task);
+        return NULL;
+    }
+    return task;
+}
+
+static void TaskFree(struct EventLoop *loop, struct Task *task) {
+    task->next = loop->task_free;
+    loop->task_free = task;
+}
+
+// Читаем, пока есть место во входном буфере, не превышен лимит задач
+// в работе и не достигнут конец потока, и пишем, пока есть ответы.
+// EPOLLRDHUP остаётся и без EPOLLIN, пока не пришёл: иначе закрытие
+// записи клиентом не заметить, пока пул разбирает его задачи
+static void ConnUpdateEvents(struct Connection *conn) {
+    uint32_t events = conn->shut_rd ? 0 : EPOLLRDHUP;
+    if (!conn->eof && !ReaderFull(&conn->reader) && conn->inflight < CONN_MAX_INFLIGHT)
+        events |= EPOLLIN;
+
+    // У eventfd нет уровня для данных в кольце: счётчик сброшен при
+    // пробуждении, поэтому, если читать снова можно, а в кольце
+    // остались байты, будим себя сами. Место для записи освободит
+    // клиент и разбудит нас сам
+    if (conn->reader.shm != NULL) {
+        if ((events & EPOLLIN) && ShmReadable(&conn->shm))
+            ShmWakeSelf(&conn->shm);
+        return;
+    }
+    if (WriterPending(&conn->writer))
+        events |= EPOLLOUT;
+    if (events == conn->events)
+        return;
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = conn;
+    epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->events = events;
+}
+
+static void ConnFree(struct Connection *conn) {
+    ReaderDestroy(&conn->reader);
+    WriterDestroy(&conn->writer);
+    free(conn->ready);
+    free(conn);
+}
+
+static void ConnRelease(struct Connection *conn) {
+    conn->next_free = conn->loop->free_head;
+    conn->loop->free_head = conn;
+}
+
+static void ConnClose(struct Connection *conn) {
+    struct EventLoop *loop = conn->loop;
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    if (conn->reader.shm != NULL) {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->shm.wake_fd, NULL);
+        ShmClose(&conn->shm);
+    }
+    shutdown(conn->fd, SHUT_RDWR);
+    close(conn->fd);
+    conn->fd = -1;
+    // Флаг читают рабочие потоки, чтобы бросить задачи этого соединения
+    __atomic_store_n(&conn->closed, true, __ATOMIC_RELAXED);
+    loop->connections--;
+
+    const struct IoStats *stats = &conn->stats;
+    uint64_t syscalls = stats->read_calls + stats->write_calls;
+    LOG_D("Connection closed: tasks %lu, recv %lu, send %lu, syscalls/task %.2f",
+           conn->tasks_done, stats->read_calls, stats->write_calls,
+           conn->tasks_done ? (double)syscalls / conn->tasks_done : 0.0);
+    METRIC_DEC(connections_active);
+
+    // Незавершённые задачи ещё ссылаются на соединение: освободим
+    // его, когда рабочие потоки вернут последнюю из них
+    if (conn->inflight == 0)
+        ConnRelease(conn);
+}
+
+// Клиент больше ничего не пришлёт, а все ответы ему уже отданы.
+// Незаконченный кадр в буфере дочитать уже нельзя
+static bool ConnDrained(const struct Connection *conn) {
+    return conn->eof && conn->inflight == 0 && conn->ready_num == 0 &&
+           !WriterPending(&conn->writer);
+}
+
+// Возвращает false, если соединение нужно закрыть
+static bool ConnFlush(struct Connection *conn) {
+    uint64_t calls = conn->stats.write_calls;
+    uint64_t bytes = conn->stats.bytes_out;
+    int res = WriterFlush(&conn->writer);
+    METRIC_ADD(write_calls, conn->stats.write_calls - calls);
+    METRIC_ADD(bytes_out, conn->stats.bytes_out - bytes);
+    if (res < 0) {
+        LOG_W("Can't send data to client");
+        METRIC_INC(errors);
+        return false;
+    }
+    ConnUpdateEvents(conn);
+    return true;
+}
+
+// Откладывает результат до конца текущего прохода цикла
+static bool ConnAddResult(struct Connection *conn, uint64_t id, uint32_t status,
+                          uint64_t value, struct Connection **dirty_head) {
+    if (conn->ready_num == conn->ready_cap) {
+        uint32_t cap = conn->ready_cap ? conn->ready_cap * 2 : 16;
+        struct ResultMsg *ready = realloc(conn->ready, cap * sizeof(struct ResultMsg));
+        if (ready == NULL)
+            return false;
+        conn->ready = ready;
+        conn->ready_cap = cap;
+    }
+
+    struct ResultMsg *result = &conn->ready[conn->ready_num++];
+    result->id = id;
+    result->status = status;
+    result->value = value;
+    result->queue_ns = 0;
+    result->compute_ns = 0;
+
+    if (!conn->dirty) {
+        conn->dirty = true;
+        conn->next_dirty = *dirty_head;
+        *dirty_head = conn;
+    }
+    return true;
+}
+
+// Посчитанная задача: в ответ попадают времена ожидания и счёта,
+// по ним клиент строит трассу
+static bool ConnAddDone(struct Connection *conn, uint64_t id, uint64_t value,
+                        uint64_t queue_ns, uint64_t compute_ns, struct Connection **dirty_head) {
+    if (!ConnAddResult(conn, id, STATUS_OK, value, dirty_head))
+        return false;
+    struct ResultMsg *result = &conn->ready[conn->ready_num - 1];
+    result->queue_ns = queue_ns;
+    result->compute_ns = compute_ns;
+    return true;
+}
+
+// Все накопленные результаты соединения уходят одним кадром
+static bool ConnSendResults(struct Connection *conn) {
+    while (conn->ready_num > 0) {
+        uint32_t count = conn->ready_num;
+        if (count > MAX_FRAME_TASKS)
+            count = MAX_FRAME_TASKS;
+
+        char *header = WriterReserve(&conn->writer, FRAME_HEADER_SIZE);
+        if (header == NULL)
+            return false;
+        PutFrameHeader(header, MSG_RESULTS, count);
+
+        for (uint32_t i = 0; i < count; i++) {
+            char *buf = WriterReserve(&conn->writer, RESULT_MSG_SIZE);
+            if (buf == NULL)
+                return false;
+            PutResult(buf, &conn->ready[i]);
+        }
+        conn->tasks_done += count;
+
+        conn->ready_num -= count;
+        memmove(conn->ready, conn->ready + count, conn->ready_num * sizeof(struct ResultMsg));
+    }
+    return ConnFlush(conn);
+}
+
+// Рабочий поток: задача посчитана, передаём её циклу
+static void OnJobDone(struct FactorialJob *job) {
+    struct Task *task = (struct Task *)job->ctx;
+    struct EventLoop *loop = task->conn->loop;
+
+    pthread_mutex_lock(&loop->done_lock);
+    task->next = loop->done_head;
+    loop->done_head = task;
+    pthread_mutex_unlock(&loop->done_lock);
+
+    uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG_E("Can not wake event loop");
+}
+
+// Занимает место под задачу, если лимит не исчерпан
+static bool AdmissionAcquire(struct Admission *admission) {
+    uint32_t admitted = __atomic_load_n(&admission->admitted, __ATOMIC_RELAXED);
+    do {
+        if (admitted >= admission->limit)
+            return false;
+    } while (!__atomic_compare_exchange_n(&admission->admitted, &admitted, admitted + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    METRIC_INC(tasks_queued);
+    uint64_t peak = __atomic_load_n(&g_metrics.tasks_queued_max, __ATOMIC_RELAXED);
+    while (admitted + 1 > peak &&
+           !__atomic_compare_exchange_n(&g_metrics.tasks_queued_max, &peak, admitted + 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    return true;
+}
+
+static void AdmissionRelease(struct Admission *admission) {
+    __atomic_fetch_sub(&admission->admitted, 1, __ATOMIC_RELAXED);
+    METRIC_DEC(tasks_queued);
+}
+
+// Через сколько миллисекунд стоит повторить: столько пул будет
+// разбирать уже принятые задачи при нынешнем времени задачи
+static uint64_t AdmissionRetryAfterMs(const struct Admission *admission, int tnum) {
+    uint64_t admitted = __atomic_load_n(&admission->admitted, __ATOMIC_RELAXED);
+    uint64_t work_ns = __atomic_load_n(&admission->work_ns, __ATOMIC_RELAXED);
+    uint64_t ms = admitted * work_ns / (uint64_t)tnum / 1000000;
+    return ms > 0 ? ms : 1;
+}
+
+// Дешёвая задача считается прямо в цикле событий: очередь пула и
+// пробуждение потока стоили бы дороже самого счёта
+static bool ConnRunInline(struct Connection *conn, const struct TaskMsg *msg,
+                          const struct FactorialCancel *cancel, uint64_t recv_ns,
+                          struct Connection **dirty_head) {
+    METRIC_INC(plan_inline);
+    uint64_t value = 0;
+    uint64_t start_ns = NowNs();
+    if (FactorialChecked(&msg->args, cancel, &value) != FACTORIAL_DONE) {
+        METRIC_INC(tasks_expired);
+        return ConnAddResult(conn, msg->id, STATUS_EXPIRED, 0, dirty_head);
+    }
+
+    uint64_t done_ns = NowNs();
+    HistRecord(&g_metrics.queue_ns, start_ns - recv_ns);
+    HistRecord(&g_metrics.compute_ns, done_ns - start_ns);
+    HistRecord(&g_metrics.total_ns, done_ns - recv_ns);
+    METRIC_INC(tasks_ok);
+    LOG_D("Trace %016lx: inline, compute %lu ns", msg->trace_id, done_ns - start_ns);
+    return ConnAddDone(conn, msg->id, value, start_ns - recv_ns, done_ns - start_ns, dirty_head);
+}
+
+static bool ConnStartTask(struct Connection *conn, const struct TaskMsg *msg,
+                          struct Connection **dirty_head) {
+    const struct FactorialArgs *args = &msg->args;
+
+    METRIC_INC(tasks);
+    LOG_D("Receive: %lu %lu %lu type %u trace %016lx", args->begin, args->end, args->mod,
+          args->type, msg->trace_id);
+
+    // Полный диапазон [0, UINT64_MAX] - 2^64 чисел: их количество не
+    // помещается в uint64_t, а посчитать их всё равно нельзя
+    if (args->begin > args->end || args->end - args->begin == UINT64_MAX || args->mod == 0) {
+        LOG_W("Invalid range: begin=%lu, end=%lu, mod=%lu",
+                args->begin, args->end, args->mod);
+        METRIC_INC(tasks_invalid);
+        return ConnAddResult(conn, msg->id, STATUS_INVALID, 0, dirty_head);
+    }
+    // Дальше тип проверять не нужно: ядро выбирается по индексу
+    if (KernelGet(args->type) == NULL) {
+        LOG_W("Unknown task type %u", args->type);
+        METRIC_INC(tasks_invalid);
+        return ConnAddResult(conn, msg->id, STATUS_INVALID, 0, dirty_head);
+    }
+    METRIC_INC(kernel_tasks[args->type]);
+
+    uint64_t recv_ns = NowNs();
+    struct FactorialCancel cancel;
+    cancel.deadline_ns = 0;
+    if (msg->timeout_ms != 0)
+        cancel.deadline_ns = recv_ns + (uint64_t)msg->timeout_ms * 1000000;
+    cancel.cancelled = &conn->closed;
+
+    // Встроенные задачи тоже проходят допуск: пока пул насыщен,
+    // мелкие задачи получают STATUS_BUSY наравне с крупными и не
+    // отнимают у цикла время, нужное для раздачи готовых ответов
+    struct Admission *admission = conn->loop->admission;
+    if (!AdmissionAcquire(admission)) {
+        METRIC_INC(tasks_rejected);
+        return ConnAddResult(conn, msg->id, STATUS_BUSY,
+                             AdmissionRetryAfterMs(admission, conn->loop->tnum), dirty_head);
+    }
+
+    struct Plan plan;
+    PlannerDecide(conn->loop->planner, args, PoolIdle(conn->loop->pool), &plan);
+    if (plan.run_inline) {
+        bool ok = ConnRunInline(conn, msg, &cancel, recv_ns, dirty_head);
+        AdmissionRelease(admission);
+        return ok;
+    }
+
+    struct Task *task = TaskAlloc(conn->loop);
+    if (task == NULL) {
+        LOG_E("Memory allocation failed");
+        AdmissionRelease(admission);
+        return ConnAddResult(conn, msg->id, STATUS_ERROR, 0, dirty_head);
+    }
+    task->id = msg->id;
+    task->trace_id = msg->trace_id;
+    task->recv_ns = recv_ns;
+    task->conn = conn;
+
+    METRIC_INC(plan_pooled);
+    METRIC_ADD(plan_parts, plan.parts);
+    conn->inflight++;
+    if (!JobStart(&task->job, conn->loop->pool, args, plan.parts, &cancel, OnJobDone, task)) {
+        LOG_E("Thread pool is stopped");
+        AdmissionRelease(admission);
+        conn->inflight--;
+        TaskFree(conn->loop, task);
+        return false;
+    }
+    return true;
+}
+
+// Текущие метрики одним кадром MSG_STATS
+static bool ConnSendStats(struct Connection *conn) {
+    char text[8192];
+    METRIC_INC(stats_requests);
+    size_t len = MetricsFormat(text, sizeof(text), PoolQueueDepth(conn->loop->pool), LogDropped());
+
+    char *header = WriterReserve(&conn->writer, FRAME_HEADER_SIZE);
+    if (header == NULL)
+        return false;
+    PutFrameHeader(header, MSG_STATS, (uint32_t)len);
+    if (!WriterAppend(&conn->writer, text, len))
+        return false;
+    return ConnFlush(conn);
+}
+
+// Разбирает накопленные байты: заголовок кадра, затем задачи по одной,
+// пока не кончатся данные или не будет достигнут лимит задач в работе
+static bool ConnProcessInput(struct Connection *conn, struct Connection **dirty_head) {
+    struct FrameReader *reader = &conn->reader;
+
+    while (conn->inflight < CONN_MAX_INFLIGHT) {
+        if (!conn->in_frame) {
+            if (ReaderAvailable(reader) < FRAME_HEADER_SIZE)
+                break;
+
+            struct FrameHeader header;
+            if (!GetFrameHeader(ReaderPeek(reader), &header) ||
+                (header.type != MSG_TASKS && header.type != MSG_STATS_REQUEST)) {
+                LOG_W("Client send wrong data format");
+                METRIC_INC(errors);
+                return false;
+            }
+            ReaderConsume(reader, FRAME_HEADER_SIZE);
+            METRIC_INC(frames);
+
+            if (header.type == MSG_STATS_REQUEST) {
+                if (!ConnSendStats(conn))
+                    return false;
+                continue;
+            }
+            conn->tasks_left = header.count;
+            conn->in_frame = header.count > 0;
+            continue;
+        }
+
+        if (ReaderAvailable(reader) < TASK_MSG_SIZE)
+            break;
+
+        struct TaskMsg msg;
+        GetTask(ReaderPeek(reader), &msg);
+        ReaderConsume(reader, TASK_MSG_SIZE);
+        if (--conn->tasks_left == 0)
+            conn->in_frame = false;
+
+        if (!ConnStartTask(conn, &msg, dirty_head))
+            return false;
+    }
+
+    return true;
+}
+
+static void LoopSendDirty(struct Connection *dirty) {
+    while (dirty != NULL) {
+        struct Connection *next = dirty->next_dirty;
+        dirty->dirty = false;
+        if (dirty->closed)
+            dirty->ready_num = 0;
+        else if (!ConnSendResults(dirty) || ConnDrained(dirty))
+            ConnClose(dirty);
+        dirty = next;
+    }
+}
+
+// Клиент закрыл запись, но его задачи ещё считаются. Если он закрыл
+// сокет целиком, на пустой кадр результатов ядро клиента ответит RST,
+// придёт EPOLLHUP, и задачи отменятся сразу, а не после первого ответа
+static bool ConnProbePeer(struct Connection *conn) {
+    char *header = WriterReserve(&conn->writer, FRAME_HEADER_SIZE);
+    if (header == NULL)
+        return false;
+    PutFrameHeader(header, MSG_RESULTS, 0);
+    return ConnFlush(conn);
+}
+
+static void ConnRead(struct Connection *conn) {
+    // Один recv за событие: если данных больше, epoll сообщит снова,
+    // а лишний вызов с EAGAIN не тратится
+    long n = 1;
+    if (!ReaderFull(&conn->reader)) {
+        n = ReaderFill(&conn->reader);
+        METRIC_INC(read_calls);
+        if (n > 0)
+            METRIC_ADD(bytes_in, n);
+    }
+    // Конец потока: задачи, которые уже в буфере, всё равно разбираем
+    bool eof = n == 0 && !conn->eof;
+    if (eof)
+        conn->eof = true;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_W("Client read failed");
+        METRIC_INC(errors);
+        ConnClose(conn);
+        return;
+    }
+
+    struct Connection *dirty = NULL;
+    bool ok = ConnProcessInput(conn, &dirty);
+    LoopSendDirty(dirty);
+    if (conn->closed)
+        return;
+    if (!ok || ConnDrained(conn) || (eof && conn->inflight > 0 && !ConnProbePeer(conn))) {
+        ConnClose(conn);
+        return;
+    }
+    ConnUpdateEvents(conn);
+}
+
+// Пробуждение shm-соединения: клиент положил данные или освободил
+// место, которого ждали ответы
+static void ConnShmWake(struct Connection *conn) {
+    ShmDrainWake(&conn->shm);
+    if (WriterPending(&conn->writer) && !ConnFlush(conn)) {
+        ConnClose(conn);
+        return;
+    }
+    ConnRead(conn);
+}
+
+// Подписка на события нового соединения. Управляющий сокет shm нужен
+// только для того, чтобы заметить отключение клиента: данных по нему
+// не идёт, и закрытие его клиентом значит, что клиента больше нет
+static bool ConnWatch(struct Connection *conn) {
+    int epoll_fd = conn->loop->epoll_fd;
+    struct epoll_event ev;
+    ev.data.ptr = conn;
+    if (conn->reader.shm == NULL) {
+        ev.events = conn->events;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) == 0;
+    }
+
+    ev.events = EPOLLRDHUP;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0)
+        return false;
+    ev.events = EPOLLIN;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->shm.wake_fd, &ev) < 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        return false;
+    }
+    return true;
+}
+
+static void LoopAccept(struct EventLoop *loop, const struct Listener *listener) {
+    while (true) {
+        int client_fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                LOG_E("Could not establish new connection");
+            return;
+        }
+
+        struct Connection *conn = calloc(1, sizeof(struct Connection));
+        if (conn == NULL) {
+            LOG_E("Memory allocation failed");
+            close(client_fd);
+            continue;
+        }
+        conn->fd = client_fd;
+        conn->loop = loop;
+        conn->events = EPOLLIN | EPOLLRDHUP;
+        WriterInit(&conn->writer, client_fd, &conn->stats);
+        if (!ReaderInit(&conn->reader, client_fd, CONN_IN_SIZE, &conn->stats)) {
+            LOG_E("Memory allocation failed");
+            close(client_fd);
+            ConnFree(conn);
+            continue;
+        }
+
+        if (listener->shm) {
+            if (!ShmAccept(&conn->shm, client_fd)) {
+                LOG_E("Can not set up shared memory for client");
+                close(client_fd);
+                ConnFree(conn);
+                continue;
+            }
+            conn->reader.shm = &conn->shm;
+            conn->writer.shm = &conn->shm;
+        }
+
+        if (!ConnWatch(conn)) {
+            LOG_E("Can not watch client socket");
+            if (conn->reader.shm != NULL)
+                ShmClose(&conn->shm);
+            close(client_fd);
+            ConnFree(conn);
+            continue;
+        }
+        loop->connections++;
+        METRIC_INC(connections_accepted);
+        METRIC_INC(connections_active);
+    }
+}
+
+static void LoopCompleted(struct EventLoop *loop) {
+    uint64_t counter;
+    if (read(loop->wake_fd, &counter, sizeof(counter)) < 0 && errno != EAGAIN)
+        LOG_E("Can not read wake counter");
+
+    pthread_mutex_lock(&loop->done_lock);
+    struct Task *task = loop->done_head;
+    loop->done_head = NULL;
+    pthread_mutex_unlock(&loop->done_lock);
+
+    struct Connection *dirty = NULL;
+    while (task != NULL) {
+        struct Task *next = task->next;
+        struct Connection *conn = task->conn;
+        conn->inflight--;
+
+        const struct FactorialJob *job = &task->job;
+        if (job->stop == FACTORIAL_CANCELLED)
+            METRIC_INC(tasks_cancelled);
+
+        struct Admission *admission = loop->admission;
+        AdmissionRelease(admission);
+        if (job->stop == FACTORIAL_DONE) {
+            uint64_t work = (job->done_ns - job->start_ns) * (uint64_t)job->parts_num;
+            uint64_t avg = __atomic_load_n(&admission->work_ns, __ATOMIC_RELAXED);
+            // Потеря обновления от другого цикла для оценки не страшна
+            avg = avg ? (avg * 7 + work) / 8 : work;
+            __atomic_store_n(&admission->work_ns, avg, __ATOMIC_RELAXED);
+        }
+
+        if (conn->closed) {
+            if (conn->inflight == 0)
+                ConnRelease(conn);
+        } else if (job->stop == FACTORIAL_EXPIRED) {
+            LOG_D("Trace %016lx: task %lu expired", task->trace_id, task->id);
+            METRIC_INC(tasks_expired);
+            if (!ConnAddResult(conn, task->id, STATUS_EXPIRED, 0, &dirty))
+                ConnClose(conn);
+        } else {
+            uint64_t queue_ns = job->start_ns - task->recv_ns;
+            uint64_t compute_ns = job->done_ns - job->start_ns;
+            LOG_D("Trace %016lx: total %lu, queue %lu ns, compute %lu ns in %d parts",
+                  task->trace_id, job->total, queue_ns, compute_ns, job->parts_num);
+            HistRecord(&g_metrics.queue_ns, queue_ns);
+            HistRecord(&g_metrics.compute_ns, compute_ns);
+            HistRecord(&g_metrics.total_ns, NowNs() - task->recv_ns);
+            METRIC_INC(tasks_ok);
+            if (!ConnAddDone(conn, task->id, job->total, queue_ns, compute_ns, &dirty))
+                ConnClose(conn);
+        }
+
+        TaskFree(loop, task);
+        task = next;
+    }
+
+    // Лимит задач мог освободиться: дочитываем отложенные кадры
+    for (struct Connection *conn = dirty; conn != NULL; conn = conn->next_dirty) {
+        if (!conn->closed && !ConnProcessInput(conn, &dirty))
+            ConnClose(conn);
+    }
+    LoopSendDirty(dirty);
+}
+
+bool LoopInit(struct EventLoop *loop, int listen_fd, struct ThreadPool *pool,
+              struct Admission *admission, const struct Planner *planner, int tnum) {
+    loop->listeners_num = 0;
+    loop->pool = pool;
+    loop->admission = admission;
+    loop->planner = planner;
+    loop->tnum = tnum;
+    loop->done_head = NULL;
+    loop->task_free = NULL;
+    loop->free_head = NULL;
+    loop->connections = 0;
+
+    loop->epoll_fd = epoll_create1(0);
+    if (loop->epoll_fd < 0)
+        return false;
+
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (loop->wake_fd < 0) {
+        close(loop->epoll_fd);
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->wake_fd;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev);
+
+    if (!LoopAddListener(loop, listen_fd, false)) {
+        close(loop->epoll_fd);
+        close(loop->wake_fd);
+        return false;
+    }
+
+    pthread_mutex_init(&loop->done_lock, NULL);
+    return true;
+}
+
+bool LoopAddListener(struct EventLoop *loop, int listen_fd, bool shm) {
+    if (loop->listeners_num == LOOP_MAX_LISTENERS || !SetNonBlocking(listen_fd))
+        return false;
+
+    struct Listener *listener = &loop->listeners[loop->listeners_num];
+    listener->fd = listen_fd;
+    listener->shm = shm;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = listener;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+        return false;
+    loop->listeners_num++;
+    return true;
+}
+
+static struct Listener *LoopFindListener(struct EventLoop *loop, void *ptr) {
+    for (int i = 0; i < loop->listeners_num; i++) {
+        if (ptr == &loop->listeners[i])
+            return &loop->listeners[i];
+    }
+    return NULL;
+}
+
+void LoopRun(struct EventLoop *loop) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_E("epoll_wait failed");
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            struct Listener *listener = LoopFindListener(loop, ptr);
+            if (listener != NULL) {
+                LoopAccept(loop, listener);
+            } else if (ptr == &loop->wake_fd) {
+                LoopCompleted(loop);
+            } else {
+                struct Connection *conn = (struct Connection *)ptr;
+                // Соединение могло быть закрыто раньше в этой же пачке событий
+                if (conn->closed)
+                    continue;
+                uint32_t revents = events[i].events;
+                if (revents & (EPOLLERR | EPOLLHUP)) {
+                    ConnClose(conn);
+                    continue;
+                }
+                if (conn->reader.shm != NULL) {
+                    if (revents & EPOLLRDHUP)
+                        ConnClose(conn);
+                    else
+                        ConnShmWake(conn);
+                    continue;
+                }
+                // Закрытие записи ещё не отключение: клиент может ждать
+                // ответы после shutdown(SHUT_WR). Отключение заметит
+                // ConnProbePeer, когда ConnRead дочитает поток до конца
+                if (revents & EPOLLRDHUP)
+                    conn->shut_rd = true;
+                if (revents & EPOLLOUT) {
+                    if (!ConnFlush(conn) || ConnDrained(conn)) {
+                        ConnClose(conn);
+                        continue;
+                    }
+                }
+                if (revents & (EPOLLIN | EPOLLRDHUP))
+                    ConnRead(conn);
+            }
+        }
+
+        while (loop->free_head != NULL) {
+            struct Connection *conn = loop->free_head;
+            loop->free_head = conn->next_free;
+            ConnFree(conn);
+        }
+    }
+}
+
+void LoopDestroy(struct EventLoop *loop) {
+    while (loop->task_free != NULL) {
+        struct Task *task = loop->task_free;
+        loop->task_free = task->next;
+        JobDestroy(&task->job);
+        free(task);
+    }
+    close(loop->epoll_fd);
+    close(loop->wake_fd);
+    pthread_mutex_destroy(&loop->done_lock);
+}
@@ -0,0 +1,114 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "job.h"
+#include "plan.h"
+#include "pool.h"
+#include "transport.h"
+
+#define CONN_IN_SIZE 4096
+#define CONN_MAX_INFLIGHT 1024
+#define LOOP_MAX_LISTENERS 4
+
+struct Connection;
+
+// Одна задача из кадра клиента. Объекты переиспользуются через
+// список свободных задач цикла, поэтому части FactorialJob
+// выделяются только при первом использовании.
+struct Task {
+    struct FactorialJob job;
+    uint64_t id;
+    uint64_t trace_id;
+    uint64_t recv_ns;
+    struct Connection *conn;
+    struct Task *next;
+};
+
+// Состояние одного клиентского соединения
+struct Connection {
+    int fd;
+    struct EventLoop *loop;
+
+    // Для shm-соединений fd - управляющий сокет, а данные идут через
+    // кольца; reader и writer тогда указывают на shm
+    struct ShmChannel shm;
+
+    struct IoStats stats;
+    struct FrameReader reader;
+    struct FrameWriter writer;
+    uint32_t tasks_left;  // задач текущего кадра ещё не прочитано
+    bool in_frame;
+    uint64_t tasks_done;
+
+    // Готовые результаты, которые уйдут одним кадром MSG_RESULTS
+    struct ResultMsg *ready;
+    uint32_t ready_num;
+    uint32_t ready_cap;
+    bool dirty;
+
+    int inflight;   // задач в пуле
+    bool closed;    // клиент отключился, ждём завершения задач
+    // Клиент закрыл свою сторону на запись (EPOLLRDHUP): то, что уже
+    // пришло, дочитываем до конца потока (eof) и отвечаем на всё
+    bool shut_rd;
+    bool eof;
+    uint32_t events;  // текущая подписка epoll
+
+    struct Connection *next_dirty;
+    struct Connection *next_free;
+};
+
+// Допуск задач, общий для всех циклов: на сервере не больше limit
+// принятых и ещё не посчитанных задач. Сверх лимита задача сразу
+// получает STATUS_BUSY, а не ждёт в очереди без границ
+struct Admission {
+    uint32_t limit;
+    uint32_t admitted;
+    uint64_t work_ns;  // скользящее среднее времени задачи, сложенного по частям
+};
+
+// Слушающий сокет и транспорт соединений, принятых через него
+struct Listener {
+    int fd;
+    bool shm;
+};
+
+// Однопоточный цикл на epoll: принимает соединения, разбирает кадры
+// по мере поступления байт и отдаёт задачи пулу. Рабочие потоки
+// возвращают готовые задачи через список done и eventfd.
+struct EventLoop {
+    int epoll_fd;
+    struct Listener listeners[LOOP_MAX_LISTENERS];
+    int listeners_num;
+    int wake_fd;
+
+    struct ThreadPool *pool;
+    struct Admission *admission;
+    const struct Planner *planner;
+    int tnum;
+
+    pthread_mutex_t done_lock;
+    struct Task *done_head;
+
+    struct Task *task_free;
+
+    // Закрытые соединения освобождаются после обработки пачки событий,
+    // чтобы не обращаться к освобождённой памяти в той же пачке
+    struct Connection *free_head;
+
+    int connections;
+};
+
+bool LoopInit(struct EventLoop *loop, int listen_fd, struct ThreadPool *pool,
+              struct Admission *admission, const struct Planner *planner, int tnum);
+// Ещё один слушающий сокет: AF_UNIX, а при shm - для колец в общей памяти
+bool LoopAddListener(struct EventLoop *loop, int listen_fd, bool shm);
+void LoopRun(struct EventLoop *loop);
+void LoopDestroy(struct EventLoop *loop);
+
+#endif
@@ -0,0 +1,165 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+struct ServerMetrics g_metrics;
+
+static int HistIndex(uint64_t value) {
+    if (value < HIST_LINEAR)
+        return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS;
+    return HIST_LINEAR + (msb - HIST_SUB_BITS - 1) * HIST_SUB +
+           (int)((value >> shift) - HIST_SUB);
+}
+
+// Верхняя граница корзины: оценка значения сверху
+static uint64_t HistBucketValue(int index) {
+    if (index < HIST_LINEAR)
+        return (uint64_t)index;
+    int octave = (index - HIST_LINEAR) / HIST_SUB;
+    int sub = (index - HIST_LINEAR) % HIST_SUB;
+    int shift = octave + 1;
+    return (((uint64_t)(HIST_SUB + sub) + 1) << shift) - 1;
+}
+
+void HistRecord(struct Histogram *hist, uint64_t value) {
+    __atomic_fetch_add(&hist->counts[HistIndex(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&hist->max, &max, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void HistMerge(struct Histogram *dst, const struct Histogram *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->counts[i] += __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+    dst->total += __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (max > dst->max)
+        dst->max = max;
+}
+
+void HistCorrect(struct Histogram *dst, const struct Histogram *src, uint64_t interval) {
+    HistMerge(dst, src);
+    if (interval == 0)
+        return;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        uint64_t count = src->counts[i];
+        if (count == 0)
+            continue;
+        uint64_t value = HistBucketValue(i);
+        if (value > src->max)
+            value = src->max;
+        for (uint64_t missed = value > interval ? value - interval : 0; missed >= interval;
+             missed -= interval) {
+            dst->counts[HistIndex(missed)] += count;
+            dst->total += count;
+            dst->sum += missed * count;
+        }
+    }
+}
+
+uint64_t HistPercentile(const struct Histogram *hist, double q) {
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        total += hist->counts[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * total);
+    if (rank >= total)
+        rank = total - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > rank) {
+            uint64_t value = HistBucketValue(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+struct TextBuf {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void TextPrintf(struct TextBuf *text, const char *fmt, ...) {
+    if (text->len + 1 >= text->size)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(text->buf + text->len, text->size - text->len, fmt, args);
+    va_end(args);
+    if (n > 0)
+        text->len += (size_t)n < text->size - text->len ? (size_t)n : text->size - text->len - 1;
+}
+
+static void FormatHist(struct TextBuf *text, const char *name, const struct Histogram *src) {
+    // Снимок, чтобы перцентили считались по согласованным данным
+    struct Histogram snap;
+    memset(&snap, 0, sizeof(snap));
+    HistMerge(&snap, src);
+
+    TextPrintf(text, "%s_count %lu\n", name, snap.total);
+    TextPrintf(text, "%s_avg_us %.1f\n", name, snap.total ? snap.sum / 1e3 / snap.total : 0.0);
+    TextPrintf(text, "%s_p50_us %.1f\n", name, HistPercentile(&snap, 0.50) / 1e3);
+    TextPrintf(text, "%s_p99_us %.1f\n", name, HistPercentile(&snap, 0.99) / 1e3);
+    TextPrintf(text, "%s_p999_us %.1f\n", name, HistPercentile(&snap, 0.999) / 1e3);
+    TextPrintf(text, "%s_max_us %.1f\n", name, snap.max / 1e3);
+}
+
+size_t MetricsFormat(char *buf, size_t size, uint64_t queue_depth, uint64_t log_dropped) {
+    struct TextBuf text = {buf, size, 0};
+    const struct ServerMetrics *m = &g_metrics;
+
+#define COUNTER(name) TextPrintf(&text, #name " %lu\n", __atomic_load_n(&m->name, __ATOMIC_RELAXED))
+    COUNTER(frames);
+    COUNTER(tasks);
+    COUNTER(tasks_ok);
+    COUNTER(tasks_invalid);
+    COUNTER(tasks_expired);
+    COUNTER(tasks_cancelled);
+    COUNTER(tasks_rejected);
+    COUNTER(tasks_queued);
+    COUNTER(tasks_queued_max);
+    COUNTER(plan_inline);
+    COUNTER(plan_pooled);
+    COUNTER(plan_parts);
+    COUNTER(plan_step_ps);
+    COUNTER(kernel_call_ns);
+    COUNTER(errors);
+    COUNTER(bytes_in);
+    COUNTER(bytes_out);
+    COUNTER(read_calls);
+    COUNTER(write_calls);
+    COUNTER(connections_accepted);
+    COUNTER(connections_active);
+    COUNTER(stats_requests);
+#undef COUNTER
+    for (uint32_t type = 0; type < TASK_TYPES; type++)
+        TextPrintf(&text, "tasks_%s %lu\n", KernelGet(type)->name,
+                   __atomic_load_n(&m->kernel_tasks[type], __ATOMIC_RELAXED));
+    TextPrintf(&text, "queue_depth %lu\n", queue_depth);
+    TextPrintf(&text, "log_dropped %lu\n", log_dropped);
+
+    FormatHist(&text, "queue", &m->queue_ns);
+    FormatHist(&text, "compute", &m->compute_ns);
+    FormatHist(&text, "total", &m->total_ns);
+
+    if (size > 0)
+        buf[text.len] = '\0';
+    return text.len;
+}
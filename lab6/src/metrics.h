@@ -0,0 +1,77 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernel.h"
+
+// Гистограмма в духе HDR: значения до 32 хранятся точно, дальше каждая
+// степень двойки делится на 16 корзин, т.е. относительная ошибка
+// не больше ~6%. Запись - один атомарный инкремент, без блокировок.
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_LINEAR (2 * HIST_SUB)
+#define HIST_BUCKETS (HIST_LINEAR + (64 - HIST_SUB_BITS - 1) * HIST_SUB)
+
+struct Histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+};
+
+void HistRecord(struct Histogram *hist, uint64_t value);
+// Значение, не меньше которого q-я доля записей (q от 0 до 1)
+uint64_t HistPercentile(const struct Histogram *hist, double q);
+// Складывает src в dst (снимок для отчёта)
+void HistMerge(struct Histogram *dst, const struct Histogram *src);
+// Поправка на coordinated omission, как в HdrHistogram: каждая запись v
+// больше interval дополняется значениями v - interval, v - 2 * interval...
+// Это запросы, которые нагрузка не отправила, пока ждала ответа.
+// Результат складывается в dst
+void HistCorrect(struct Histogram *dst, const struct Histogram *src, uint64_t interval);
+
+// Счётчики и гистограммы сервера. Обновляются атомарно из цикла
+// событий и рабочих потоков, читаются запросом статистики.
+struct ServerMetrics {
+    uint64_t frames;
+    uint64_t tasks;
+    uint64_t tasks_ok;
+    uint64_t tasks_invalid;
+    uint64_t tasks_expired;    // остановлены по дедлайну
+    uint64_t tasks_cancelled;  // остановлены из-за отключения клиента
+    uint64_t tasks_rejected;   // не приняты из-за перегрузки (STATUS_BUSY)
+    uint64_t tasks_queued;     // приняты и ещё не посчитаны
+    uint64_t tasks_queued_max;
+    uint64_t plan_inline;   // посчитаны в цикле событий
+    uint64_t plan_pooled;   // отданы пулу
+    uint64_t plan_parts;    // сумма частей отданных пулу задач
+    uint64_t plan_step_ps;  // откалиброванная цена шага MultModulo
+    uint64_t kernel_call_ns;  // накладные расходы вызова ядра, на кусок
+    uint64_t kernel_tasks[TASK_TYPES];  // принятые задачи по типам
+    uint64_t errors;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t read_calls;
+    uint64_t write_calls;
+    uint64_t connections_accepted;
+    uint64_t connections_active;
+    uint64_t stats_requests;
+
+    struct Histogram queue_ns;    // от приёма задачи до начала вычисления
+    struct Histogram compute_ns;  // от начала до конца вычисления
+    struct Histogram total_ns;    // от приёма задачи до постановки ответа
+};
+
+extern struct ServerMetrics g_metrics;
+
+#define METRIC_ADD(name, value) __atomic_fetch_add(&g_metrics.name, (value), __ATOMIC_RELAXED)
+#define METRIC_INC(name) METRIC_ADD(name, 1)
+#define METRIC_DEC(name) __atomic_fetch_sub(&g_metrics.name, 1, __ATOMIC_RELAXED)
+
+// Текстовый отчёт "имя значение" по строке на метрику. Возвращает
+// длину текста (не больше size - 1)
+size_t MetricsFormat(char *buf, size_t size, uint64_t queue_depth, uint64_t log_dropped);
+
+#endif
@@ -0,0 +1,91 @@
+#include "plan.h"
+
+// Калибровочный диапазон: числа по 21 биту, модуль как у клиента
+#define CALIBRATE_BEGIN (1ULL << 20)
+#define CALIBRATE_COUNT 20000
+#define CALIBRATE_ROUNDS 3
+// Вызовов ядра на одном числе при замере накладных расходов
+#define CALIBRATE_CALLS 4096
+
+static int BitLength(uint64_t x) {
+    return x ? 64 - __builtin_clzll(x) : 1;
+}
+
+// Шагов ядра на одно число диапазона
+static uint64_t StepsPerNumber(const struct Kernel *kernel, const struct FactorialArgs *args) {
+    switch (kernel->cost) {
+    case KERNEL_COST_END_BITS:
+        return BitLength(args->end);
+    case KERNEL_COST_MOD_BITS:
+        return BitLength(args->mod);
+    default:
+        return 1;
+    }
+}
+
+void PlannerInit(struct Planner *planner, enum PlanMode mode, int max_parts) {
+    planner->mode = mode;
+    planner->max_parts = max_parts;
+
+    // Минимум из нескольких прогонов: первый платит за прогрев кэшей
+    // и частоты процессора
+    for (uint32_t type = 0; type < TASK_TYPES; type++) {
+        struct FactorialArgs args = {CALIBRATE_BEGIN, CALIBRATE_BEGIN + CALIBRATE_COUNT - 1,
+                                     1000000007, type};
+        uint64_t best = UINT64_MAX;
+        for (int i = 0; i < CALIBRATE_ROUNDS; i++) {
+            uint64_t start = NowNs();
+            volatile uint64_t sink = Factorial(&args);
+            (void)sink;
+            uint64_t elapsed = NowNs() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+        uint64_t steps = (uint64_t)CALIBRATE_COUNT * StepsPerNumber(KernelGet(type), &args);
+        planner->step_ps[type] = best * 1000 / steps;
+        if (planner->step_ps[type] == 0)
+            planner->step_ps[type] = 1;
+    }
+
+    // Цена проверки отмены и косвенного вызова ядра: её платит каждый
+    // кусок из FACTORIAL_CHUNK чисел, а не каждое число. Вызов на одно
+    // число включает и поиск ядра, который бывает раз на вызов
+    struct FactorialArgs one = {CALIBRATE_BEGIN, CALIBRATE_BEGIN, 1000000007, TASK_SUM};
+    struct FactorialCancel cancel = {0, NULL};
+    uint64_t start = NowNs();
+    uint64_t value;
+    for (int i = 0; i < CALIBRATE_CALLS; i++)
+        FactorialChecked(&one, &cancel, &value);
+    planner->call_ns = (NowNs() - start) / CALIBRATE_CALLS;
+}
+
+void PlannerDecide(const struct Planner *planner, const struct FactorialArgs *args,
+                   int idle, struct Plan *plan) {
+    // Чисел span + 1: для [0, UINT64_MAX] это 2^64, в uint64_t не
+    // помещается, поэтому дальше считаем только через span
+    uint64_t span = args->end - args->begin;
+    const struct Kernel *kernel = KernelGet(args->type);
+    double cost = ((double)span + 1.0) * StepsPerNumber(kernel, args) * planner->step_ps[args->type] / 1000.0;
+    plan->cost_ns = cost < (double)UINT64_MAX ? (uint64_t)cost : UINT64_MAX;
+
+    plan->run_inline = false;
+    plan->parts = planner->max_parts;
+    if (planner->mode == PLAN_ADAPTIVE) {
+        if (plan->cost_ns < PLAN_INLINE_NS) {
+            plan->run_inline = true;
+            plan->parts = 0;
+            return;
+        }
+        // Когда все потоки заняты, дробить бессмысленно: части всё
+        // равно встанут в очередь, а накладные расходы вырастут
+        uint64_t parts = plan->cost_ns / PLAN_PART_NS;
+        int limit = idle > 1 ? idle : 1;
+        if (limit > planner->max_parts)
+            limit = planner->max_parts;
+        plan->parts = parts < (uint64_t)limit ? (int)parts : limit;
+        if (plan->parts < 1)
+            plan->parts = 1;
+    }
+    if ((uint64_t)plan->parts - 1 > span)
+        plan->parts = (int)(span + 1);
+}
@@ -0,0 +1,51 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "kernel.h"
+
+// Планировщик параллелизма сервера. Стоимость диапазона оценивается по
+// модели: MultModulo делает по шагу на каждый бит множителя, так что
+// диапазон факториала [begin, end] стоит примерно (end - begin + 1) *
+// bits(end) шагов; для других ядер см. enum KernelCost. Цена шага
+// измеряется при старте для каждого ядра. Дешёвые диапазоны
+// считаются сразу в цикле событий без похода в пул, дорогие делятся
+// на части не меньше PLAN_PART_NS, но не больше, чем свободных потоков.
+
+// Дешевле этого диапазон считается в цикле событий
+#define PLAN_INLINE_NS 20000
+// Минимальная работа одной части: накладные расходы на часть
+// (очередь пула, пробуждение потока) остаются в пределах процентов
+#define PLAN_PART_NS 200000
+
+enum PlanMode {
+    PLAN_ADAPTIVE,
+    PLAN_FIXED,  // как раньше: всегда max_parts частей
+};
+
+struct Planner {
+    enum PlanMode mode;
+    int max_parts;
+    uint64_t step_ps[TASK_TYPES];  // цена одного шага ядра, пикосекунды
+    uint64_t call_ns;  // вызов ядра на одном числе: цена выбора ядра и проверок
+};
+
+struct Plan {
+    bool run_inline;
+    int parts;
+    uint64_t cost_ns;
+};
+
+// Замеряет цену шага каждого ядра и накладные расходы вызова
+// (несколько миллисекунд)
+void PlannerInit(struct Planner *planner, enum PlanMode mode, int max_parts);
+
+// Решение для диапазона при idle свободных потоках пула. Тип задачи
+// должен быть известен (KernelGet)
+void PlannerDecide(const struct Planner *planner, const struct FactorialArgs *args,
+                   int idle, struct Plan *plan);
+
+#endif
@@ -0,0 +1,109 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+static void *PoolWorker(void *arg) {
+    struct ThreadPool *pool = (struct ThreadPool *)arg;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->count == 0 && !pool->stop)
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+
+        if (pool->count == 0 && pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        struct PoolTask task = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        __atomic_fetch_add(&pool->active, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        task.fn(task.arg);
+        __atomic_fetch_sub(&pool->active, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+bool PoolInit(struct ThreadPool *pool, int threads_num, size_t capacity) {
+    pool->threads = malloc(threads_num * sizeof(pthread_t));
+    pool->queue = malloc(capacity * sizeof(struct PoolTask));
+    if (pool->threads == NULL || pool->queue == NULL) {
+        free(pool->threads);
+        free(pool->queue);
+        return false;
+    }
+
+    pool->threads_num = 0;
+    pool->capacity = capacity;
+    pool->head = 0;
+    pool->count = 0;
+    pool->active = 0;
+    pool->stop = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+
+    for (int i = 0; i < threads_num; i++) {
+        if (pthread_create(&pool->threads[i], NULL, PoolWorker, pool)) {
+            PoolDestroy(pool);
+            return false;
+        }
+        pool->threads_num++;
+    }
+
+    return true;
+}
+
+bool PoolSubmit(struct ThreadPool *pool, PoolFn fn, void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == pool->capacity && !pool->stop)
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+
+    if (pool->stop) {
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+
+    size_t tail = (pool->head + pool->count) % pool->capacity;
+    pool->queue[tail].fn = fn;
+    pool->queue[tail].arg = arg;
+    pool->count++;
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+size_t PoolQueueDepth(struct ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    size_t depth = pool->count;
+    pthread_mutex_unlock(&pool->lock);
+    return depth;
+}
+
+int PoolIdle(struct ThreadPool *pool) {
+    int busy = __atomic_load_n(&pool->active, __ATOMIC_RELAXED) +
+               (int)__atomic_load_n(&pool->count, __ATOMIC_RELAXED);
+    return pool->threads_num > busy ? pool->threads_num - busy : 0;
+}
+
+void PoolDestroy(struct ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_cond_broadcast(&pool->not_full);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->threads_num; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_cond_destroy(&pool->not_full);
+    free(pool->threads);
+    free(pool->queue);
+}
@@ -0,0 +1,49 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Задача для пула: функция и её аргумент
+typedef void (*PoolFn)(void *arg);
+
+struct PoolTask {
+    PoolFn fn;
+    void *arg;
+};
+
+// Пул рабочих потоков, создаваемых один раз при старте сервера.
+// Задачи хранятся в кольцевой очереди фиксированной ёмкости.
+struct ThreadPool {
+    pthread_t *threads;
+    int threads_num;
+
+    struct PoolTask *queue;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int active;  // потоков, выполняющих задачу
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    bool stop;
+};
+
+bool PoolInit(struct ThreadPool *pool, int threads_num, size_t capacity);
+
+// Добавляет задачу в очередь, ожидая свободного места
+bool PoolSubmit(struct ThreadPool *pool, PoolFn fn, void *arg);
+
+// Число задач, ожидающих свободного потока
+size_t PoolQueueDepth(struct ThreadPool *pool);
+
+// Сколько потоков сейчас простаивает с учётом уже ждущих задач.
+// Читается без блокировки, поэтому значение приблизительное
+int PoolIdle(struct ThreadPool *pool);
+
+// Дожидается выполнения очереди и останавливает потоки
+void PoolDestroy(struct ThreadPool *pool);
+
+#endif
@@ -0,0 +1,205 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <getopt.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "job.h"
+#include "kernel.h"
+#include "pool.h"
+
+// Сравнение старой схемы сервера (pthread_create на каждый запрос)
+// с постоянным пулом потоков. Для каждого k несколько клиентских
+// потоков непрерывно отправляют запросы [1, k].
+
+enum Mode { MODE_SPAWN, MODE_POOL };
+
+struct BenchClient {
+    pthread_t thread_id;
+    enum Mode mode;
+    int tnum;
+    uint64_t k;
+    uint64_t mod;
+    int requests;
+    struct ThreadPool *pool;
+    double *latencies;
+    uint64_t check;
+};
+
+static double NowSec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *ThreadFactorial(void *args) {
+    struct FactorialArgs *fargs = (struct FactorialArgs *)args;
+    uint64_t *result = malloc(sizeof(uint64_t));
+    *result = Factorial(fargs);
+    return (void *)result;
+}
+
+// Обработка запроса так, как это делал сервер до появления пула
+static uint64_t SpawnRequest(const struct FactorialArgs *range, int tnum) {
+    pthread_t threads[tnum];
+    struct FactorialArgs args[tnum];
+
+    // Как и JobStart: пустой и полный диапазоны не делятся
+    if (range->end < range->begin || range->end - range->begin == UINT64_MAX)
+        return 0;
+    uint64_t numbers_count = range->end - range->begin + 1;
+    if ((uint64_t)tnum > numbers_count)
+        tnum = (int)numbers_count;
+    uint64_t numbers_per_thread = numbers_count / tnum;
+    uint64_t remainder = numbers_count % tnum;
+    uint64_t current = range->begin;
+
+    for (int i = 0; i < tnum; i++) {
+        args[i].begin = current;
+        args[i].end = current + numbers_per_thread - 1;
+        if ((uint64_t)i < remainder)
+            args[i].end++;
+        args[i].mod = range->mod;
+        args[i].type = range->type;
+        current = args[i].end + 1;
+        pthread_create(&threads[i], NULL, ThreadFactorial, &args[i]);
+    }
+
+    uint64_t total = 1;
+    for (int i = 0; i < tnum; i++) {
+        uint64_t *result = NULL;
+        pthread_join(threads[i], (void **)&result);
+        total = MultModulo(total, *result, range->mod);
+        free(result);
+    }
+    return total;
+}
+
+static void *ClientLoop(void *arg) {
+    struct BenchClient *client = (struct BenchClient *)arg;
+    struct FactorialArgs range = {1, client->k, client->mod, TASK_FACTORIAL};
+    struct FactorialJob job;
+
+    if (client->mode == MODE_POOL && !JobInit(&job, client->tnum))
+        return NULL;
+
+    for (int i = 0; i < client->requests; i++) {
+        double start = NowSec();
+        uint64_t total = 0;
+        if (client->mode == MODE_SPAWN)
+            total = SpawnRequest(&range, client->tnum);
+        else
+            JobRun(&job, client->pool, &range, &total);
+        client->latencies[i] = NowSec() - start;
+        client->check = total;
+    }
+
+    if (client->mode == MODE_POOL)
+        JobDestroy(&job);
+    return NULL;
+}
+
+static int CompareDouble(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void RunBench(enum Mode mode, struct ThreadPool *pool, int tnum,
+                     int clients_num, int requests, uint64_t k, uint64_t mod) {
+    struct BenchClient clients[clients_num];
+    double *latencies = malloc((size_t)clients_num * requests * sizeof(double));
+
+    double start = NowSec();
+    for (int i = 0; i < clients_num; i++) {
+        clients[i].mode = mode;
+        clients[i].tnum = tnum;
+        clients[i].k = k;
+        clients[i].mod = mod;
+        clients[i].requests = requests;
+        clients[i].pool = pool;
+        clients[i].latencies = latencies + (size_t)i * requests;
+        pthread_create(&clients[i].thread_id, NULL, ClientLoop, &clients[i]);
+    }
+    for (int i = 0; i < clients_num; i++)
+        pthread_join(clients[i].thread_id, NULL);
+    double elapsed = NowSec() - start;
+
+    int total = clients_num * requests;
+    qsort(latencies, total, sizeof(double), CompareDouble);
+    double sum = 0;
+    for (int i = 0; i < total; i++)
+        sum += latencies[i];
+
+    printf("%s,%d,%d,%lu,%d,%.2f,%.2f,%.2f,%.0f,%lu\n",
+           mode == MODE_SPAWN ? "spawn" : "pool", tnum, clients_num, k, total,
+           sum / total * 1e6, latencies[total / 2] * 1e6,
+           latencies[(int)(total * 0.99)] * 1e6, total / elapsed,
+           clients[0].check);
+    free(latencies);
+}
+
+int main(int argc, char **argv) {
+    int tnum = 4;
+    int clients_num = 4;
+    int requests = 2000;
+    uint64_t mod = 1000000007;
+    uint64_t ks[] = {10, 100, 1000, 10000, 100000};
+    int ks_num = sizeof(ks) / sizeof(ks[0]);
+
+    while (true) {
+        static struct option options[] = {{"tnum", required_argument, 0, 0},
+                                          {"clients", required_argument, 0, 0},
+                                          {"requests", required_argument, 0, 0},
+                                          {0, 0, 0, 0}};
+
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "", options, &option_index);
+        if (c == -1)
+            break;
+        if (c != 0) {
+            fprintf(stderr, "Using: %s --tnum 4 --clients 4 --requests 2000\n", argv[0]);
+            return 1;
+        }
+
+        int value = atoi(optarg);
+        if (value <= 0) {
+            fprintf(stderr, "%s must be positive\n", options[option_index].name);
+            return 1;
+        }
+        switch (option_index) {
+        case 0:
+            tnum = value;
+            break;
+        case 1:
+            clients_num = value;
+            break;
+        case 2:
+            requests = value;
+            break;
+        }
+    }
+
+    struct ThreadPool pool;
+    if (!PoolInit(&pool, tnum, (size_t)tnum * clients_num)) {
+        fprintf(stderr, "Can not create thread pool\n");
+        return 1;
+    }
+
+    printf("mode,tnum,clients,k,requests,avg_us,p50_us,p99_us,req_per_sec,result\n");
+    for (int i = 0; i < ks_num; i++) {
+        // Для больших k уменьшаем число запросов, чтобы прогон был коротким
+        int n = ks[i] >= 100000 ? requests / 20 + 1 : requests;
+        RunBench(MODE_SPAWN, &pool, tnum, clients_num, n, ks[i], mod);
+        RunBench(MODE_POOL, &pool, tnum, clients_num, n, ks[i], mod);
+    }
+
+    PoolDestroy(&pool);
+    return 0;
+}
@@ -0,0 +1,65 @@
+#!/bin/bash
+# Масштабирование сервера по числу акцепторов (--acceptors): для каждого
+# n от 1 до N сервер запускается заново, несколько процессов loadgen
+# гоняют по нему мелкие задачи, чтобы узким местом был приём и разбор
+# соединений, а не счёт. Результат - CSV на stdout.
+#
+# Использование: ./scale_acceptors.sh [N] [порт] [tnum] [процессов loadgen]
+
+max_acceptors=${1:-4}
+port=${2:-20101}
+tnum=${3:-4}
+generators=${4:-4}
+duration=${DURATION:-3}
+connections=${CONNECTIONS:-16}
+inflight=${INFLIGHT:-16}
+
+if [ ! -x ./server ] || [ ! -x ./loadgen ]; then
+    echo "Ошибка: сначала соберите server и loadgen (make)" >&2
+    exit 1
+fi
+
+tmp=$(mktemp -d)
+server_pid=
+
+cleanup() {
+    if [ -n "$server_pid" ]; then
+        kill "$server_pid" 2>/dev/null
+        wait "$server_pid" 2>/dev/null
+    fi
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+echo "acceptors,generators,connections,qps,speedup,max_p99_ms"
+base_qps=
+for n in $(seq 1 "$max_acceptors"); do
+    ./server --port "$port" --tnum "$tnum" --acceptors "$n" --log-level warn &
+    server_pid=$!
+    sleep 0.5
+
+    for g in $(seq 1 "$generators"); do
+        ./loadgen --server "127.0.0.1:$port" --mode closed --connections "$connections" \
+            --inflight "$inflight" --range fixed:1 --duration "$duration" --seed "$g" --csv \
+            | tail -n 1 > "$tmp/$g.csv" &
+    done
+    wait $(jobs -p | grep -v "^$server_pid$")
+
+    kill "$server_pid"
+    wait "$server_pid" 2>/dev/null
+    server_pid=
+
+    # Суммарный qps и худший p99 по всем генераторам
+    cat "$tmp"/*.csv | awk -F, -v n="$n" -v g="$generators" -v c="$connections" -v base="$base_qps" '
+        { qps += $10; if ($12 > p99) p99 = $12 }
+        END {
+            if (base == "") base = qps
+            speedup = 0
+            if (base > 0) speedup = qps / base
+            printf "%d,%d,%d,%.0f,%.2f,%.3f\n", n, g, g * c, qps, speedup, p99
+        }' | tee "$tmp/row"
+    if [ -z "$base_qps" ]; then
+        base_qps=$(cut -d, -f4 "$tmp/row")
+    fi
+    rm -f "$tmp"/*.csv
+done
@@ -0,0 +1,125 @@
+#!/bin/bash
+# Масштабирование по числу серверов: для каждого n от 1 до N на loopback
+# запускаются n серверов, каждый со своим --tnum и привязанный taskset
+# к своим tnum ядрам (при нехватке ядер номера идут по кругу). Для
+# каждого k из KS клиент считает k! на n серверах. Ускорение и
+# эффективность считаются относительно одного сервера. Серверы
+# останавливаются по их pid, в том числе при ошибке и Ctrl+C.
+# Результат - CSV на stdout.
+#
+# Использование: ./scale_servers.sh [N] [tnum] [первый порт]
+
+max_servers=${1:-4}
+tnum=${2:-1}
+base_port=${3:-20201}
+ks=${KS:-"1000000 10000000 50000000"}
+mod=${MOD:-1000000007}
+repeats=${REPEATS:-3}
+
+if [ ! -x ./server ] || [ ! -x ./client ]; then
+    echo "Ошибка: сначала соберите server и client (make)" >&2
+    exit 1
+fi
+
+cpus=$(nproc)
+pin=
+if command -v taskset > /dev/null; then
+    pin=yes
+else
+    echo "# taskset не найден, серверы работают без привязки к ядрам" >&2
+fi
+if [ $((max_servers * tnum)) -gt "$cpus" ]; then
+    echo "# ядер $cpus, серверам нужно $((max_servers * tnum)): часть ядер будет общей" >&2
+fi
+
+tmp=$(mktemp -d)
+servers_file="$tmp/servers.txt"
+server_pids=()
+
+stop_servers() {
+    if [ ${#server_pids[@]} -gt 0 ]; then
+        kill "${server_pids[@]}" 2>/dev/null
+        wait "${server_pids[@]}" 2>/dev/null
+    fi
+    server_pids=()
+}
+
+cleanup() {
+    stop_servers
+    rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Ядра i-го сервера: tnum подряд, по кругу
+server_cpus() {
+    local first=$(( $1 * tnum ))
+    local list=
+    for j in $(seq 0 $((tnum - 1))); do
+        list="$list${list:+,}$(( (first + j) % cpus ))"
+    done
+    echo "$list"
+}
+
+start_servers() {
+    : > "$servers_file"
+    for i in $(seq 0 $(($1 - 1))); do
+        local port=$((base_port + i))
+        if [ -n "$pin" ]; then
+            taskset -c "$(server_cpus "$i")" ./server --port "$port" --tnum "$tnum" --log-level warn &
+        else
+            ./server --port "$port" --tnum "$tnum" --log-level warn &
+        fi
+        server_pids+=($!)
+        echo "127.0.0.1:$port" >> "$servers_file"
+    done
+
+    # Ждём, пока все серверы начнут отвечать на запрос статистики
+    for _ in $(seq 1 50); do
+        if ./client --stats --servers "$servers_file" --log-level off > /dev/null 2>&1; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "Ошибка: серверы не запустились" >&2
+    return 1
+}
+
+# Лучшее время из repeats прогонов, мс; пусто, если результат неверен
+run_client() {
+    local best=
+    for _ in $(seq 1 "$repeats"); do
+        ./client --k "$1" --mod "$mod" --servers "$servers_file" --log-level error > "$tmp/run.txt" 2>&1
+        if ! grep -q "Results match: YES" "$tmp/run.txt"; then
+            return 1
+        fi
+        local ms
+        ms=$(awk '/tasks completed in/ { for (i = 1; i <= NF; i++) if ($i == "in") print $(i + 1) }' "$tmp/run.txt")
+        if [ -z "$best" ] || awk -v a="$ms" -v b="$best" 'BEGIN { exit !(a < b) }'; then
+            best=$ms
+        fi
+    done
+    echo "$best"
+}
+
+echo "# ks: $ks, mod $mod, tnum $tnum, repeats $repeats" >&2
+echo "servers,tnum,k,time_ms,speedup,efficiency"
+declare -A base_ms
+for n in $(seq 1 "$max_servers"); do
+    start_servers "$n" || exit 1
+    for k in $ks; do
+        ms=$(run_client "$k")
+        if [ -z "$ms" ]; then
+            echo "Ошибка: неверный результат для k=$k на $n серверах" >&2
+            exit 1
+        fi
+        if [ "$n" -eq 1 ]; then
+            base_ms[$k]=$ms
+        fi
+        awk -v n="$n" -v t="$tnum" -v k="$k" -v ms="$ms" -v base="${base_ms[$k]}" 'BEGIN {
+            speedup = ms > 0 ? base / ms : 0
+            printf "%d,%d,%s,%.3f,%.2f,%.2f\n", n, t, k, ms, speedup, speedup / n
+        }'
+    done
+    stop_servers
+done
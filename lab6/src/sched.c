@@ -0,0 +1,407 @@
+#include "sched.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define WINDOW_INIT 4
+// Границы очереди на сервере в задачах (алгоритм в духе TCP Vegas):
+// меньше ALPHA - сервер может простаивать, больше BETA - он копит
+// задачи, которые в конце прогона лучше бы отдать другим
+#define WINDOW_ALPHA 1.0
+#define WINDOW_BETA 3.0
+// Сколько ответов нужно, чтобы доверять оценке p95 для хеджа
+#define HEDGE_MIN_SAMPLES 16
+#define HEDGE_PERCENTILE 0.95
+
+static void PendingPush(struct Scheduler *sched, struct ClientTask *task) {
+    task->next = NULL;
+    if (sched->pending_tail != NULL)
+        sched->pending_tail->next = task;
+    else
+        sched->pending_head = task;
+    sched->pending_tail = task;
+}
+
+// Повторы идут в начало очереди, чтобы не задерживать финиш
+static void PendingPushFront(struct Scheduler *sched, struct ClientTask *task) {
+    task->next = sched->pending_head;
+    sched->pending_head = task;
+    if (sched->pending_tail == NULL)
+        sched->pending_tail = task;
+}
+
+static struct ClientTask *PendingPop(struct Scheduler *sched) {
+    struct ClientTask *task = sched->pending_head;
+    if (task != NULL) {
+        sched->pending_head = task->next;
+        if (sched->pending_head == NULL)
+            sched->pending_tail = NULL;
+    }
+    return task;
+}
+
+// Деление с округлением вверх без переполнения: k может быть любым,
+// вплоть до UINT64_MAX, и k + n - 1 тогда переполнилось бы
+static uint64_t DivCeil(uint64_t k, uint64_t n) {
+    return k / n + (k % n != 0);
+}
+
+// Длина задачи, при которой запрос делится на tasks_per_query частей
+static uint64_t QueryChunk(const struct Query *query, uint64_t tasks_per_query) {
+    uint64_t tasks = query->k < tasks_per_query ? query->k : tasks_per_query;
+    return tasks ? DivCeil(query->k, tasks) : 1;
+}
+
+bool SchedInit(struct Scheduler *sched, struct Query *queries, int queries_num,
+               uint64_t tasks_per_query, int servers_num) {
+    memset(sched, 0, sizeof(*sched));
+    if (tasks_per_query == 0)
+        tasks_per_query = 1;
+
+    size_t tasks_num = 0;
+    for (int q = 0; q < queries_num; q++) {
+        uint64_t chunk = QueryChunk(&queries[q], tasks_per_query);
+        uint64_t n = DivCeil(queries[q].k, chunk);
+        // Задачи всех запросов лежат в одном массиве
+        if (n > SIZE_MAX / sizeof(struct ClientTask) - tasks_num)
+            return false;
+        tasks_num += n;
+    }
+
+    sched->tasks = calloc(tasks_num ? tasks_num : 1, sizeof(struct ClientTask));
+    sched->servers = calloc(servers_num, sizeof(struct ServerLoad));
+    if (sched->tasks == NULL || sched->servers == NULL) {
+        free(sched->tasks);
+        free(sched->servers);
+        return false;
+    }
+
+    sched->queries = queries;
+    sched->queries_num = queries_num;
+    sched->tasks_num = tasks_num;
+    sched->servers_num = servers_num;
+    sched->servers_alive = servers_num;
+    sched->max_retries = SCHED_DEFAULT_RETRIES;
+    sched->timeout_ns = SCHED_DEFAULT_TIMEOUT_MS * 1000000ULL;
+
+    size_t id = 0;
+    for (int q = 0; q < queries_num; q++) {
+        uint64_t chunk = QueryChunk(&queries[q], tasks_per_query);
+        queries[q].kernel = KernelGet(queries[q].type);
+        queries[q].result = queries[q].kernel->identity;
+        queries[q].tasks_left = 0;
+        queries[q].start_ns = 0;
+        queries[q].done_ns = 0;
+        // Следующее начало считается от конца задачи: begin + chunk
+        // после последней задачи при k около UINT64_MAX переполнилось бы
+        uint64_t end = 0;
+        while (end < queries[q].k) {
+            uint64_t begin = end + 1;
+            end = queries[q].k - begin >= chunk ? begin + chunk - 1 : queries[q].k;
+            struct ClientTask *task = &sched->tasks[id];
+            task->id = id;
+            task->args.begin = begin;
+            task->args.end = end;
+            task->args.mod = queries[q].mod;
+            task->args.type = queries[q].type;
+            task->query = q;
+            task->state = TASK_PENDING;
+            for (int i = 0; i < 2; i++) {
+                task->copies[i].task = task;
+                task->copies[i].server = -1;
+            }
+            PendingPush(sched, task);
+            queries[q].tasks_left++;
+            id++;
+        }
+    }
+
+    for (int i = 0; i < servers_num; i++)
+        sched->servers[i].window = WINDOW_INIT;
+
+    pthread_mutex_init(&sched->lock, NULL);
+    sched->start_ns = NowNs();
+    return true;
+}
+
+void SchedDestroy(struct Scheduler *sched) {
+    pthread_mutex_destroy(&sched->lock);
+    free(sched->tasks);
+    free(sched->servers);
+}
+
+static bool Finished(const struct Scheduler *sched) {
+    return sched->aborted || sched->done_num == sched->tasks_num;
+}
+
+// Выдаёт копию задачи серверу и ставит её в конец его списка
+static void CopyAttach(struct Scheduler *sched, struct TaskCopy *copy, int server,
+                       uint64_t now) {
+    struct ServerLoad *load = &sched->servers[server];
+    copy->server = server;
+    copy->sent_ns = now;
+    copy->next = NULL;
+    copy->prev = load->newest;
+    if (load->newest != NULL)
+        load->newest->next = copy;
+    else
+        load->oldest = copy;
+    load->newest = copy;
+
+    if (load->inflight++ == 0)
+        load->busy_since = now;
+}
+
+static void CopyDetach(struct Scheduler *sched, struct TaskCopy *copy, uint64_t now) {
+    struct ServerLoad *load = &sched->servers[copy->server];
+    if (copy->prev != NULL)
+        copy->prev->next = copy->next;
+    else
+        load->oldest = copy->next;
+    if (copy->next != NULL)
+        copy->next->prev = copy->prev;
+    else
+        load->newest = copy->prev;
+    copy->server = -1;
+
+    if (--load->inflight == 0)
+        load->busy_ns += now - load->busy_since;
+}
+
+// Копия задачи, выданная серверу, или NULL
+static struct TaskCopy *TaskCopyOf(struct ClientTask *task, int server) {
+    for (int i = 0; i < 2; i++) {
+        if (task->copies[i].server == server)
+            return &task->copies[i];
+    }
+    return NULL;
+}
+
+static bool TaskAssigned(const struct ClientTask *task) {
+    return task->copies[COPY_PRIMARY].server >= 0 || task->copies[COPY_HEDGE].server >= 0;
+}
+
+// Задача потеряна вместе с сервером или вернулась с ошибкой. Если
+// у неё нет живой копии, она снова встаёт в очередь
+static void TaskLost(struct Scheduler *sched, struct ClientTask *task) {
+    if (task->state != TASK_INFLIGHT || TaskAssigned(task))
+        return;
+    if (++task->attempts > sched->max_retries) {
+        LOG_E("Task %lu failed %d times, giving up", task->id, task->attempts);
+        sched->aborted = true;
+        return;
+    }
+    task->state = TASK_PENDING;
+    sched->retries++;
+    PendingPushFront(sched, task);
+}
+
+// Самая старая задача другого сервера, которая считается дольше p95
+// и ещё не продублирована. Списки копий упорядочены по времени
+// отправки, поэтому у каждого сервера просматривается только голова
+static struct ClientTask *HedgeCandidate(struct Scheduler *sched, int server, uint64_t now) {
+    if (sched->latency_ns.total < HEDGE_MIN_SAMPLES)
+        return NULL;
+    uint64_t threshold = HistPercentile(&sched->latency_ns, HEDGE_PERCENTILE);
+
+    struct TaskCopy *best = NULL;
+    for (int s = 0; s < sched->servers_num; s++) {
+        if (s == server)
+            continue;
+        for (struct TaskCopy *copy = sched->servers[s].oldest; copy != NULL; copy = copy->next) {
+            if (now - copy->sent_ns <= threshold)
+                break;
+            struct ClientTask *task = copy->task;
+            if (task->state != TASK_INFLIGHT || copy != &task->copies[COPY_PRIMARY] ||
+                task->copies[COPY_HEDGE].server >= 0)
+                continue;
+            if (best == NULL || copy->sent_ns < best->sent_ns)
+                best = copy;
+            break;
+        }
+    }
+    return best ? best->task : NULL;
+}
+
+int SchedTake(struct Scheduler *sched, int server, struct ClientTask **out, int max) {
+    pthread_mutex_lock(&sched->lock);
+    struct ServerLoad *load = &sched->servers[server];
+    uint64_t now = NowNs();
+    int taken = 0;
+
+    while (!Finished(sched) && !load->failed && now >= load->paused_until && taken < max &&
+           load->inflight < load->window) {
+        struct ClientTask *task = PendingPop(sched);
+        if (task != NULL) {
+            task->state = TASK_INFLIGHT;
+            CopyAttach(sched, &task->copies[COPY_PRIMARY], server, now);
+            if (sched->queries[task->query].start_ns == 0)
+                sched->queries[task->query].start_ns = now;
+        } else {
+            task = sched->hedge ? HedgeCandidate(sched, server, now) : NULL;
+            if (task == NULL)
+                break;
+            LOG_D("Hedging task %lu from server %d on server %d",
+                  task->id, task->copies[COPY_PRIMARY].server, server);
+            CopyAttach(sched, &task->copies[COPY_HEDGE], server, now);
+            load->hedges++;
+        }
+        out[taken++] = task;
+    }
+
+    pthread_mutex_unlock(&sched->lock);
+    return taken;
+}
+
+// Окно подстраивается под измеренную задержку: Vegas оценивает, сколько
+// задач стоит у сервера в очереди, как window * (1 - min / avg)
+static void WindowUpdate(struct ServerLoad *load, uint64_t latency) {
+    if (load->min_latency_ns == 0 || latency < load->min_latency_ns)
+        load->min_latency_ns = latency;
+    if (load->avg_latency_ns == 0)
+        load->avg_latency_ns = latency;
+    else
+        load->avg_latency_ns = (load->avg_latency_ns * 7 + latency) / 8;
+
+    double queued = load->window * (1.0 - (double)load->min_latency_ns / load->avg_latency_ns);
+    if (queued < WINDOW_ALPHA && load->window < SCHED_WINDOW_MAX)
+        load->window++;
+    else if (queued > WINDOW_BETA && load->window > 1)
+        load->window--;
+}
+
+bool SchedComplete(struct Scheduler *sched, int server, uint64_t id, uint64_t value) {
+    if (id >= sched->tasks_num)
+        return false;
+
+    pthread_mutex_lock(&sched->lock);
+    struct ClientTask *task = &sched->tasks[id];
+    struct TaskCopy *copy = TaskCopyOf(task, server);
+    if (copy == NULL) {
+        pthread_mutex_unlock(&sched->lock);
+        return false;
+    }
+    uint64_t now = NowNs();
+    bool hedged = copy == &task->copies[COPY_HEDGE];
+    uint64_t sent_ns = copy->sent_ns;
+    CopyDetach(sched, copy, now);
+
+    struct ServerLoad *load = &sched->servers[server];
+    WindowUpdate(load, now - sent_ns);
+
+    // Вторая копия уже ответила, этот ответ лишний
+    if (task->state == TASK_DONE) {
+        pthread_mutex_unlock(&sched->lock);
+        return true;
+    }
+
+    load->tasks_done++;
+    load->numbers_done += task->args.end - task->args.begin + 1;
+    if (hedged)
+        load->hedges_won++;
+    HistRecord(&sched->latency_ns, now - sent_ns);
+
+    struct Query *query = &sched->queries[task->query];
+    query->result = query->kernel->combine(query->result, value, query->mod);
+    if (--query->tasks_left == 0)
+        query->done_ns = now;
+
+    task->state = TASK_DONE;
+    sched->done_num++;
+
+    pthread_mutex_unlock(&sched->lock);
+    return true;
+}
+
+bool SchedRetry(struct Scheduler *sched, int server, uint64_t id) {
+    if (id >= sched->tasks_num)
+        return false;
+
+    pthread_mutex_lock(&sched->lock);
+    struct ClientTask *task = &sched->tasks[id];
+    struct TaskCopy *copy = TaskCopyOf(task, server);
+    if (copy != NULL) {
+        CopyDetach(sched, copy, NowNs());
+        TaskLost(sched, task);
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return copy != NULL;
+}
+
+bool SchedBusy(struct Scheduler *sched, int server, uint64_t id, uint64_t retry_after_ns) {
+    if (id >= sched->tasks_num)
+        return false;
+
+    pthread_mutex_lock(&sched->lock);
+    struct ClientTask *task = &sched->tasks[id];
+    struct TaskCopy *copy = TaskCopyOf(task, server);
+    if (copy != NULL) {
+        uint64_t now = NowNs();
+        struct ServerLoad *load = &sched->servers[server];
+        CopyDetach(sched, copy, now);
+        load->busy_replies++;
+        if (load->paused_until < now + retry_after_ns)
+            load->paused_until = now + retry_after_ns;
+        if (load->window > 1)
+            load->window /= 2;
+
+        if (task->state == TASK_INFLIGHT && !TaskAssigned(task)) {
+            task->state = TASK_PENDING;
+            PendingPushFront(sched, task);
+        }
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return copy != NULL;
+}
+
+void SchedFail(struct Scheduler *sched, int server) {
+    pthread_mutex_lock(&sched->lock);
+    struct ServerLoad *load = &sched->servers[server];
+    uint64_t now = NowNs();
+
+    if (!load->failed) {
+        load->failed = true;
+        sched->servers_alive--;
+        while (load->oldest != NULL) {
+            struct ClientTask *task = load->oldest->task;
+            CopyDetach(sched, load->oldest, now);
+            if (task->state == TASK_INFLIGHT)
+                load->tasks_lost++;
+            TaskLost(sched, task);
+        }
+        if (sched->servers_alive == 0 && sched->done_num < sched->tasks_num) {
+            LOG_E("No servers left, %zu of %zu tasks unfinished",
+                  sched->tasks_num - sched->done_num, sched->tasks_num);
+            sched->aborted = true;
+        }
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+bool SchedExpired(struct Scheduler *sched, int server) {
+    if (sched->timeout_ns == 0)
+        return false;
+
+    // Копии проигравших дублей тоже ждут ответа: молчащий по ним
+    // сервер так же подозрителен
+    pthread_mutex_lock(&sched->lock);
+    const struct TaskCopy *oldest = sched->servers[server].oldest;
+    bool expired = oldest != NULL && NowNs() - oldest->sent_ns > sched->timeout_ns;
+    pthread_mutex_unlock(&sched->lock);
+    return expired;
+}
+
+bool SchedFinished(struct Scheduler *sched) {
+    pthread_mutex_lock(&sched->lock);
+    bool finished = Finished(sched);
+    pthread_mutex_unlock(&sched->lock);
+    return finished;
+}
+
+void SchedAbort(struct Scheduler *sched) {
+    pthread_mutex_lock(&sched->lock);
+    sched->aborted = true;
+    pthread_mutex_unlock(&sched->lock);
+}
@@ -0,0 +1,153 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "kernel.h"
+#include "metrics.h"
+
+// Планировщик клиента: k делится на много мелких задач, которые
+// серверы забирают из общей очереди по мере освобождения. Быстрый
+// сервер возвращается за работой чаще и поэтому получает больше задач.
+// Задачи отказавшего сервера возвращаются в очередь, а зависшие
+// в хвосте прогона можно продублировать на другом сервере (hedging).
+// Все функции берут блокировку планировщика и безопасны для потоков.
+
+// Верхняя граница окна задач одного сервера
+#define SCHED_WINDOW_MAX 256
+// Период, с которым клиент перепроверяет таймауты и кандидатов для хеджа
+#define SCHED_POLL_MS 50
+
+#define SCHED_DEFAULT_RETRIES 3
+#define SCHED_DEFAULT_TIMEOUT_MS 30000
+
+enum ClientTaskState {
+    TASK_PENDING,
+    TASK_INFLIGHT,
+    TASK_DONE,
+};
+
+// Копия задачи, выданная серверу. Копии сервера связаны в список
+// в порядке отправки, так что самая старая всегда в голове
+struct TaskCopy {
+    struct ClientTask *task;
+    int server;  // -1, если копия не выдана
+    uint64_t sent_ns;
+    struct TaskCopy *prev;
+    struct TaskCopy *next;
+};
+
+#define COPY_PRIMARY 0
+#define COPY_HEDGE 1
+
+struct ClientTask {
+    uint64_t id;  // индекс в массиве задач, он же id в протоколе
+    struct FactorialArgs args;
+    int query;
+    enum ClientTaskState state;
+    int attempts;  // сколько раз задача терялась вместе с сервером
+    struct TaskCopy copies[2];
+    struct ClientTask *next;
+};
+
+// Одно вычисление k! mod m или другой свёртки [1, k] (type - enum TaskType)
+struct Query {
+    uint64_t k;
+    uint64_t mod;
+    uint32_t type;
+    uint64_t result;
+    size_t tasks_left;
+    uint64_t start_ns;  // отправка первой задачи
+    uint64_t done_ns;   // ответ на последнюю
+    const struct Kernel *kernel;  // ядро type, выставляет SchedInit
+};
+
+// Состояние сервера с точки зрения планировщика
+struct ServerLoad {
+    uint64_t tasks_done;
+    double numbers_done;  // в uint64_t не поместилась бы сумма по нескольким большим k
+    uint64_t tasks_lost;  // вернулись в очередь после отказа
+    uint64_t hedges;      // дублей отправлено на этот сервер
+    uint64_t hedges_won;  // дубль ответил раньше основной копии
+    uint64_t busy_ns;     // время, когда у сервера была хоть одна задача
+    uint64_t busy_since;
+    int inflight;
+    struct TaskCopy *oldest;
+    struct TaskCopy *newest;
+    int window;           // сколько задач держать у сервера одновременно
+    bool failed;
+    uint64_t busy_replies;  // задачи, которые сервер не принял из-за перегрузки
+    uint64_t paused_until;  // до этого момента перегруженному серверу задач не даём
+    uint64_t min_latency_ns;
+    uint64_t avg_latency_ns;
+};
+
+struct Scheduler {
+    pthread_mutex_t lock;
+
+    struct Query *queries;
+    int queries_num;
+
+    struct ClientTask *tasks;
+    size_t tasks_num;
+    size_t done_num;
+    struct ClientTask *pending_head;
+    struct ClientTask *pending_tail;
+
+    struct ServerLoad *servers;
+    int servers_num;
+    int servers_alive;
+
+    // Настройки, задаются после SchedInit
+    int max_retries;
+    uint64_t timeout_ns;  // 0 - без таймаута
+    bool hedge;
+
+    struct Histogram latency_ns;  // от отправки до первого ответа
+    uint64_t retries;
+    uint64_t start_ns;
+    bool aborted;
+};
+
+// Делит каждый запрос на tasks_per_query задач (не больше k). Задачи
+// выдаются в порядке запросов, так что запросы из начала пакета
+// заканчиваются первыми. Типы запросов должны быть известны (KernelGet)
+bool SchedInit(struct Scheduler *sched, struct Query *queries, int queries_num,
+               uint64_t tasks_per_query, int servers_num);
+void SchedDestroy(struct Scheduler *sched);
+
+// Забирает для сервера до window - inflight задач. Когда очередь пуста
+// и включён hedging, выдаёт дубли задач, которые на других серверах
+// считаются дольше p95. Возвращает число задач (они записываются в out)
+int SchedTake(struct Scheduler *sched, int server, struct ClientTask **out, int max);
+
+// Учитывает ответ сервера. Ответ на уже посчитанную задачу (проигравший
+// дубль) не ошибка. Возвращает false для id, которого сервер не получал
+bool SchedComplete(struct Scheduler *sched, int server, uint64_t id, uint64_t value);
+
+// Сервер вернул ошибку по задаче: задача уходит в очередь на повтор
+bool SchedRetry(struct Scheduler *sched, int server, uint64_t id);
+
+// Сервер перегружен и задачу не принял. Задача возвращается в начало
+// очереди без траты попытки, её заберёт другой сервер; этому серверу
+// задачи не выдаются retry_after_ns, а его окно уменьшается вдвое
+bool SchedBusy(struct Scheduler *sched, int server, uint64_t id, uint64_t retry_after_ns);
+
+// Сервер отказал: его незавершённые задачи возвращаются в очередь.
+// Если живых серверов не осталось, раздача останавливается
+void SchedFail(struct Scheduler *sched, int server);
+
+// Есть ли у сервера задача, которая считается дольше таймаута
+bool SchedExpired(struct Scheduler *sched, int server);
+
+// Все задачи посчитаны или раздача остановлена
+bool SchedFinished(struct Scheduler *sched);
+
+// Останавливает раздачу задач: k! уже не собрать
+void SchedAbort(struct Scheduler *sched);
+
+#endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,38 +10,87 @@
 #include <getopt.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <pthread.h>
 
 #include "common.h"
+#include "log.h"
+#include "loop.h"
+#include "metrics.h"
+#include "pool.h"
+#include "transport.h"
+
+#define POOL_QUEUE_SIZE 65536
+#define MAX_ACCEPTORS 64
+#define MAX_QUEUE_LIMIT (1 << 20)
+
+// Слушающий сокет на порту. С reuseport несколько сокетов делят один
+// порт, и ядро само распределяет входящие соединения между ними
+static int CreateListener(int port, bool reuseport) {
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        fprintf(stderr, "Can not create server socket!");
+        return -1;
+    }
 
-uint64_t Factorial(const struct FactorialArgs *args) {
-    uint64_t ans = 1;
+    struct sockaddr_in server;
+    server.sin_family = AF_INET;
+    server.sin_port = htons((uint16_t)port);
+    server.sin_addr.s_addr = htonl(INADDR_ANY);
 
-    for (uint64_t i = args->begin; i <= args->end; i++) {
-        ans = MultModulo(ans, i, args->mod);
+    int opt_val = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+    if (reuseport && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt_val, sizeof(opt_val)) < 0) {
+        fprintf(stderr, "Can not set SO_REUSEPORT!");
+        close(server_fd);
+        return -1;
     }
 
-    return ans;
+    int err = bind(server_fd, (struct sockaddr *)&server, sizeof(server));
+    if (err < 0) {
+        fprintf(stderr, "Can not bind to socket!");
+        close(server_fd);
+        return -1;
+    }
+
+    err = listen(server_fd, SOMAXCONN);
+    if (err < 0) {
+        fprintf(stderr, "Could not listen on socket\n");
+        close(server_fd);
+        return -1;
+    }
+    return server_fd;
 }
 
-void *ThreadFactorial(void *args) {
-    struct FactorialArgs *fargs = (struct FactorialArgs *)args;
-    uint64_t *result = malloc(sizeof(uint64_t));
-    *result = Factorial(fargs);
-    return (void *)result;
+static void *AcceptorThread(void *arg) {
+    LoopRun((struct EventLoop *)arg);
+    return NULL;
 }
 
+
 int main(int argc, char **argv) {
     int tnum = -1;
     int port = -1;
+    enum LogLevel log_level = LOG_INFO;
+    int acceptors = 1;
+    const char *unix_path = NULL;
+    const char *shm_name = NULL;
+    long max_queue = -1;
+    enum PlanMode plan_mode = PLAN_ADAPTIVE;
 
     while (true) {
         int current_optind = optind ? optind : 1;
 
         static struct option options[] = {{"port", required_argument, 0, 0},
                                           {"tnum", required_argument, 0, 0},
+                                          {"log-level", required_argument, 0, 0},
+                                          {"acceptors", required_argument, 0, 0},
+                                          {"unix", required_argument, 0, 0},
+                                          {"shm", required_argument, 0, 0},
+                                          {"max-queue", required_argument, 0, 0},
+                                          {"plan", required_argument, 0, 0},
                                           {0, 0, 0, 0}};
 
         int option_index = 0;
@@ -65,6 +116,42 @@ int main(int argc, char **argv) {
                     return 1;
                 }
                 break;
+            case 2:
+                if (!LogParseLevel(optarg, &log_level)) {
+                    fprintf(stderr, "Invalid log level: %s (debug, info, warn, error, off)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 3:
+                acceptors = atoi(optarg);
+                if (acceptors <= 0 || acceptors > MAX_ACCEPTORS) {
+                    fprintf(stderr, "Acceptors number must be 1..%d\n", MAX_ACCEPTORS);
+                    return 1;
+                }
+                break;
+            case 4:
+                unix_path = optarg;
+                break;
+            case 5:
+                shm_name = optarg;
+                break;
+            case 6:
+                max_queue = atol(optarg);
+                if (max_queue <= 0 || max_queue > MAX_QUEUE_LIMIT) {
+                    fprintf(stderr, "Max queue must be 1..%d\n", MAX_QUEUE_LIMIT);
+                    return 1;
+                }
+                break;
+            case 7:
+                if (strcmp(optarg, "adaptive") == 0) {
+                    plan_mode = PLAN_ADAPTIVE;
+                } else if (strcmp(optarg, "fixed") == 0) {
+                    plan_mode = PLAN_FIXED;
+                } else {
+                    fprintf(stderr, "Invalid plan: %s (adaptive, fixed)\n", optarg);
+                    return 1;
+                }
+                break;
             default:
                 printf("Index %d is out of options\n", option_index);
             }
@@ -79,129 +166,115 @@ int main(int argc, char **argv) {
     }
 
     if (port == -1 || tnum == -1) {
-        fprintf(stderr, "Using: %s --port 20001 --tnum 4\n", argv[0]);
+        fprintf(stderr, "Using: %s --port 20001 --tnum 4 [--acceptors 1] [--log-level info]\n"
+                        "       %*s [--unix /path/to/socket] [--shm name] [--max-queue N]\n"
+                        "       %*s [--plan adaptive|fixed]\n",
+                argv[0], (int)strlen(argv[0]), "", (int)strlen(argv[0]), "");
         return 1;
     }
 
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        fprintf(stderr, "Can not create server socket!");
-        return 1;
+    // Тысячи одновременных соединений требуют поднять лимит дескрипторов
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
     }
 
-    struct sockaddr_in server;
-    server.sin_family = AF_INET;
-    server.sin_port = htons((uint16_t)port);
-    server.sin_addr.s_addr = htonl(INADDR_ANY);
+    // У каждого акцептора свой сокет на общем порту и свой цикл событий;
+    // пул потоков и метрики общие
+    int listen_fds[MAX_ACCEPTORS];
+    for (int i = 0; i < acceptors; i++) {
+        listen_fds[i] = CreateListener(port, acceptors > 1);
+        if (listen_fds[i] < 0)
+            return 1;
+    }
 
-    int opt_val = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+    // Локальные транспорты принимает только первый цикл: AF_UNIX
+    // не умеет делить сокет между слушателями
+    int local_fds[2] = {-1, -1};
+    const char *local_specs[2] = {unix_path, shm_name};
+    const char *local_prefixes[2] = {"unix:", "shm:"};
+    for (int i = 0; i < 2; i++) {
+        if (local_specs[i] == NULL)
+            continue;
+        char spec[PATH_MAX];
+        snprintf(spec, sizeof(spec), "%s%s", local_prefixes[i], local_specs[i]);
+        struct TransportAddr addr;
+        const char *error = TransportResolve(spec, &addr);
+        if (error == NULL && (local_fds[i] = TransportListen(&addr)) < 0)
+            error = strerror(errno);
+        if (error != NULL) {
+            fprintf(stderr, "Can not listen on %s: %s\n", spec, error);
+            return 1;
+        }
+    }
 
-    int err = bind(server_fd, (struct sockaddr *)&server, sizeof(server));
-    if (err < 0) {
-        fprintf(stderr, "Can not bind to socket!");
+    // Сверх max_queue задач сервер отвечает STATUS_BUSY. Очередь пула
+    // вмещает все части допущенных задач, так что цикл событий никогда
+    // не ждёт в PoolSubmit
+    if (max_queue < 0)
+        max_queue = POOL_QUEUE_SIZE / tnum > 0 ? POOL_QUEUE_SIZE / tnum : 1;
+    struct Admission admission = {(uint32_t)max_queue, 0, 0};
+
+    // Пул потоков создаётся один раз, а не на каждый запрос
+    size_t pool_capacity = (size_t)max_queue * tnum;
+    if (pool_capacity < POOL_QUEUE_SIZE)
+        pool_capacity = POOL_QUEUE_SIZE;
+    struct ThreadPool pool;
+    if (!PoolInit(&pool, tnum, pool_capacity)) {
+        fprintf(stderr, "Can not create thread pool\n");
         return 1;
     }
 
-    err = listen(server_fd, 128);
-    if (err < 0) {
-        fprintf(stderr, "Could not listen on socket\n");
+    if (!LogInit(log_level)) {
+        fprintf(stderr, "Can not start logger\n");
+        PoolDestroy(&pool);
         return 1;
     }
 
-    printf("Server listening at %d\n", port);
-
-    while (true) {
-        struct sockaddr_in client;
-        socklen_t client_len = sizeof(client);
-        int client_fd = accept(server_fd, (struct sockaddr *)&client, &client_len);
-
-        if (client_fd < 0) {
-            fprintf(stderr, "Could not establish new connection\n");
-            continue;
+    // Цена шага меряется до старта циклов, пока пул простаивает
+    struct Planner planner;
+    PlannerInit(&planner, plan_mode, tnum);
+    g_metrics.plan_step_ps = planner.step_ps[TASK_FACTORIAL];
+    g_metrics.kernel_call_ns = planner.call_ns;
+    // Цена вызова мерится на ядре sum, поэтому и доля считается от куска
+    // sum: у него на число ровно один шаг
+    LOG_I("Planner %s: %lu ps per multiply step, %lu ps per sum number, kernel call %lu ns "
+          "(%.3f%% of a sum chunk)",
+          plan_mode == PLAN_ADAPTIVE ? "adaptive" : "fixed",
+          (unsigned long)planner.step_ps[TASK_FACTORIAL], (unsigned long)planner.step_ps[TASK_SUM],
+          (unsigned long)planner.call_ns,
+          100.0 * planner.call_ns * 1000 / ((double)FACTORIAL_CHUNK * planner.step_ps[TASK_SUM]));
+
+    LOG_I("Server listening at %d with %d acceptors, max queue %ld tasks", port, acceptors, max_queue);
+    if (unix_path != NULL)
+        LOG_I("Server listening at unix:%s", unix_path);
+    if (shm_name != NULL)
+        LOG_I("Server listening at shm:%s", shm_name);
+
+    struct EventLoop loops[MAX_ACCEPTORS];
+    pthread_t threads[MAX_ACCEPTORS];
+    for (int i = 0; i < acceptors; i++) {
+        if (!LoopInit(&loops[i], listen_fds[i], &pool, &admission, &planner, tnum) ||
+            (i == 0 && local_fds[0] >= 0 && !LoopAddListener(&loops[i], local_fds[0], false)) ||
+            (i == 0 && local_fds[1] >= 0 && !LoopAddListener(&loops[i], local_fds[1], true))) {
+            LOG_E("Can not create event loop");
+            LogFlush();
+            return 1;
         }
-
-        while (true) {
-            unsigned int buffer_size = sizeof(uint64_t) * 3;
-            char from_client[buffer_size];
-            int read_bytes = recv(client_fd, from_client, buffer_size, 0);
-
-            if (read_bytes == 0)
-                break;
-            if (read_bytes < 0) {
-                fprintf(stderr, "Client read failed\n");
-                break;
-            }
-            if (read_bytes < buffer_size) {
-                fprintf(stderr, "Client send wrong data format\n");
-                break;
-            }
-
-            uint64_t begin = 0;
-            uint64_t end = 0;
-            uint64_t mod = 0;
-            memcpy(&begin, from_client, sizeof(uint64_t));
-            memcpy(&end, from_client + sizeof(uint64_t), sizeof(uint64_t));
-            memcpy(&mod, from_client + 2 * sizeof(uint64_t), sizeof(uint64_t));
-
-            fprintf(stdout, "Receive: %lu %lu %lu\n", begin, end, mod);
-
-            if (begin > end || mod == 0) {
-                fprintf(stderr, "Invalid range: begin=%lu, end=%lu, mod=%lu\n", begin, end, mod);
-                break;
-            }
-
-            // Распределение работы между потоками
-            pthread_t threads[tnum];
-            struct FactorialArgs args[tnum];
-            
-            uint64_t numbers_count = end - begin + 1;
-            uint64_t numbers_per_thread = numbers_count / tnum;
-            uint64_t remainder = numbers_count % tnum;
-            uint64_t current = begin;
-
-            for (uint32_t i = 0; i < tnum; i++) {
-                args[i].begin = current;
-                args[i].end = current + numbers_per_thread - 1;
-                
-                if (i < remainder) {
-                    args[i].end++;
-                }
-                
-                args[i].mod = mod;
-                current = args[i].end + 1;
-
-                if (pthread_create(&threads[i], NULL, ThreadFactorial, (void *)&args[i])) {
-                    fprintf(stderr, "Error: pthread_create failed!\n");
-                    return 1;
-                }
-            }
-
-            uint64_t total = 1;
-            for (uint32_t i = 0; i < tnum; i++) {
-                uint64_t *result = NULL;
-                pthread_join(threads[i], (void **)&result);
-                if (result != NULL) {
-                    total = MultModulo(total, *result, mod);
-                    free(result);
-                }
-            }
-
-            printf("Total: %lu\n", total);
-
-            char buffer[sizeof(total)];
-            memcpy(buffer, &total, sizeof(total));
-            err = send(client_fd, buffer, sizeof(total), 0);
-            if (err < 0) {
-                fprintf(stderr, "Can't send data to client\n");
-                break;
-            }
+        // Первый цикл работает в главном потоке
+        if (i > 0 && pthread_create(&threads[i], NULL, AcceptorThread, &loops[i]) != 0) {
+            LOG_E("Can not start acceptor thread");
+            LogFlush();
+            return 1;
         }
-
-        shutdown(client_fd, SHUT_RDWR);
-        close(client_fd);
     }
 
-    close(server_fd);
-    return 0;
-}
\ No newline at end of file
+    // Циклы работают, пока процесс не завершат; сюда попадаем только
+    // при ошибке epoll_wait, и процесс завершается целиком. Потоки
+    // приёма и пула ещё работают, поэтому кольца журнала не освобождаются
+    LoopRun(&loops[0]);
+
+    LogFlush();
+    return 1;
+}
@@ -0,0 +1,311 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kernel.h"
+
+uint64_t TraceRunId(void) {
+    // Перемешанные время и pid: у параллельных клиентов прогоны различаются
+    return KernelElement(NowNs() ^ ((uint64_t)getpid() << 32), UINT64_MAX);
+}
+
+bool TraceInit(struct Trace *trace, uint64_t run_id, size_t tasks_num, int servers_num) {
+    memset(trace, 0, sizeof(*trace));
+    trace->pending = malloc(2 * (tasks_num ? tasks_num : 1) * sizeof(struct TraceSpan));
+    trace->servers = calloc(servers_num, sizeof(struct TraceServer));
+    if (trace->pending == NULL || trace->servers == NULL) {
+        free(trace->pending);
+        free(trace->servers);
+        return false;
+    }
+    for (size_t i = 0; i < 2 * tasks_num; i++)
+        trace->pending[i].server = -1;
+    trace->run_id = run_id;
+    trace->start_ns = NowNs();
+    trace->tasks_num = tasks_num;
+    trace->servers_num = servers_num;
+    return true;
+}
+
+void TraceDestroy(struct Trace *trace) {
+    for (int i = 0; i < trace->servers_num; i++)
+        free(trace->servers[i].unflushed);
+    free(trace->servers);
+    free(trace->pending);
+    free(trace->spans);
+}
+
+void TraceConnectStart(struct Trace *trace, int server, const char *name) {
+    trace->servers[server].name = name;
+    trace->servers[server].connect_start_ns = NowNs();
+}
+
+void TraceConnectDone(struct Trace *trace, int server) {
+    trace->servers[server].connect_done_ns = NowNs();
+}
+
+void TraceQueued(struct Trace *trace, int server, uint64_t task_id,
+                 const struct FactorialArgs *args) {
+    if (task_id >= trace->tasks_num)
+        return;
+    struct TraceServer *srv = &trace->servers[server];
+    if (srv->unflushed_num == srv->unflushed_cap) {
+        size_t cap = srv->unflushed_cap ? srv->unflushed_cap * 2 : 64;
+        size_t *grown = realloc(srv->unflushed, cap * sizeof(size_t));
+        if (grown == NULL)
+            return;
+        srv->unflushed = grown;
+        srv->unflushed_cap = cap;
+    }
+
+    size_t index = 2 * task_id;
+    if (trace->pending[index].server >= 0)
+        index++;
+    struct TraceSpan *span = &trace->pending[index];
+    if (span->server >= 0)
+        return;
+
+    memset(span, 0, sizeof(*span));
+    span->task_id = task_id;
+    span->args = *args;
+    span->server = server;
+    span->hedge = trace->pending[index ^ 1].server >= 0;
+    span->queued_ns = NowNs();
+    srv->unflushed[srv->unflushed_num++] = index;
+}
+
+void TraceWritten(struct Trace *trace, int server) {
+    struct TraceServer *srv = &trace->servers[server];
+    uint64_t now = NowNs();
+    for (size_t i = 0; i < srv->unflushed_num; i++) {
+        struct TraceSpan *span = &trace->pending[srv->unflushed[i]];
+        if (span->server == server && span->written_ns == 0)
+            span->written_ns = now;
+    }
+    srv->unflushed_num = 0;
+}
+
+// Переносит копию из слота в список завершённых
+static void TraceFinish(struct Trace *trace, struct TraceSpan *span, uint32_t status,
+                        uint64_t now) {
+    if (trace->spans_num == trace->spans_cap) {
+        size_t cap = trace->spans_cap ? trace->spans_cap * 2 : 1024;
+        struct TraceSpan *grown = realloc(trace->spans, cap * sizeof(struct TraceSpan));
+        if (grown == NULL) {
+            span->server = -1;
+            return;
+        }
+        trace->spans = grown;
+        trace->spans_cap = cap;
+    }
+
+    span->status = status;
+    span->recv_ns = now;
+    // Ответ на часть кадра может прийти раньше, чем допишется весь кадр
+    if (span->written_ns == 0 || span->written_ns > now)
+        span->written_ns = span->queued_ns;
+    trace->spans[trace->spans_num++] = *span;
+    span->server = -1;
+}
+
+void TraceReceived(struct Trace *trace, int server, const struct ResultMsg *result) {
+    if (result->id >= trace->tasks_num)
+        return;
+    for (size_t index = 2 * result->id; index < 2 * result->id + 2; index++) {
+        struct TraceSpan *span = &trace->pending[index];
+        if (span->server == server) {
+            span->queue_ns = result->queue_ns;
+            span->compute_ns = result->compute_ns;
+            TraceFinish(trace, span, result->status, NowNs());
+            return;
+        }
+    }
+}
+
+void TraceServerFailed(struct Trace *trace, int server) {
+    uint64_t now = NowNs();
+    trace->servers[server].failed_ns = now;
+    for (size_t i = 0; i < 2 * trace->tasks_num; i++) {
+        if (trace->pending[i].server == server)
+            TraceFinish(trace, &trace->pending[i], TRACE_STATUS_LOST, now);
+    }
+    trace->servers[server].unflushed_num = 0;
+}
+
+static int CompareSpans(const void *a, const void *b) {
+    const struct TraceSpan *x = a;
+    const struct TraceSpan *y = b;
+    if (x->server != y->server)
+        return x->server - y->server;
+    return (x->queued_ns > y->queued_ns) - (x->queued_ns < y->queued_ns);
+}
+
+// Раскладывает копии сервера по дорожкам так, чтобы на одной дорожке
+// они не пересекались: иначе просмотрщик рисует их вложенными
+static int TraceAssignLanes(struct Trace *trace) {
+    qsort(trace->spans, trace->spans_num, sizeof(struct TraceSpan), CompareSpans);
+
+    uint64_t *lane_end = NULL;
+    int lanes_cap = 0, lanes_max = 0;
+    size_t i = 0;
+    while (i < trace->spans_num) {
+        int server = trace->spans[i].server;
+        int lanes = 0;
+        for (; i < trace->spans_num && trace->spans[i].server == server; i++) {
+            struct TraceSpan *span = &trace->spans[i];
+            int lane = 0;
+            while (lane < lanes && lane_end[lane] > span->queued_ns)
+                lane++;
+            if (lane == lanes) {
+                if (lanes == lanes_cap) {
+                    lanes_cap = lanes_cap ? lanes_cap * 2 : 64;
+                    uint64_t *grown = realloc(lane_end, lanes_cap * sizeof(uint64_t));
+                    if (grown == NULL) {
+                        free(lane_end);
+                        return -1;
+                    }
+                    lane_end = grown;
+                }
+                lanes++;
+            }
+            lane_end[lane] = span->recv_ns;
+            span->lane = lane;
+        }
+        if (lanes > lanes_max)
+            lanes_max = lanes;
+    }
+    free(lane_end);
+    return lanes_max;
+}
+
+static const char *StatusName(uint32_t status) {
+    switch (status) {
+    case STATUS_OK:
+        return "ok";
+    case STATUS_INVALID:
+        return "invalid";
+    case STATUS_ERROR:
+        return "error";
+    case STATUS_EXPIRED:
+        return "expired";
+    case STATUS_BUSY:
+        return "busy";
+    case TRACE_STATUS_LOST:
+        return "lost";
+    default:
+        return "unknown";
+    }
+}
+
+// Строка JSON в кавычках. Имена серверов приходят из файла серверов,
+// поэтому кавычки, обратная косая черта и управляющие символы
+// экранируются
+static void WriteJsonString(FILE *file, const char *str) {
+    fputc('"', file);
+    for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(file, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(file, "\\u%04x", *p);
+        else
+            fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+// Участок [from_ns, to_ns) на дорожке tid процесса pid
+static void WriteSpan(FILE *file, const struct Trace *trace, const char *name, int pid, int tid,
+                      uint64_t from_ns, uint64_t to_ns) {
+    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            name, pid, tid, (from_ns - trace->start_ns) / 1e3, (to_ns - from_ns) / 1e3);
+}
+
+bool TraceWrite(struct Trace *trace, const char *path) {
+    if (TraceAssignLanes(trace) < 0)
+        return false;
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"run_id\":\"%016lx\"},\n"
+                  "\"traceEvents\":[\n"
+                  "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"client\"}}",
+            trace->run_id);
+
+    // Процесс на сервер (pid = номер + 1), дорожка 0 - подключение
+    uint64_t now = NowNs();
+    for (int i = 0; i < trace->servers_num; i++) {
+        const struct TraceServer *srv = &trace->servers[i];
+        fprintf(file, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", i + 1);
+        WriteJsonString(file, srv->name != NULL ? srv->name : "?");
+        fprintf(file, "}}");
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,"
+                      "\"args\":{\"name\":\"connection\"}}", i + 1);
+        if (srv->connect_start_ns == 0)
+            continue;
+        uint64_t connected = srv->connect_done_ns;
+        if (connected == 0)
+            connected = srv->failed_ns ? srv->failed_ns : now;
+        WriteSpan(file, trace, "connect", i + 1, 0, srv->connect_start_ns, connected);
+        if (srv->failed_ns != 0)
+            fprintf(file, ",\n{\"name\":\"failed\",\"ph\":\"i\",\"s\":\"p\",\"pid\":%d,\"tid\":0,"
+                          "\"ts\":%.3f}", i + 1, (srv->failed_ns - trace->start_ns) / 1e3);
+    }
+
+    // Задача: отправка, затем ожидание ответа. Внутри ожидания участок
+    // сервера (очередь и счёт) ставится посередине, по краям - сеть
+    uint64_t send_ns = 0, net_ns = 0, queue_ns = 0, compute_ns = 0, ok = 0;
+    for (size_t i = 0; i < trace->spans_num; i++) {
+        const struct TraceSpan *span = &trace->spans[i];
+        int pid = span->server + 1;
+        int tid = span->lane + 1;
+        fprintf(file, ",\n{\"name\":\"task %lu\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                      "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"trace_id\":\"%016lx\",\"begin\":%lu,"
+                      "\"end\":%lu,\"status\":\"%s\",\"hedge\":%s,\"queue_us\":%.3f,\"compute_us\":%.3f}}",
+                span->task_id, span->hedge ? "hedge" : "task", pid, tid,
+                (span->queued_ns - trace->start_ns) / 1e3, (span->recv_ns - span->queued_ns) / 1e3,
+                TraceId(trace->run_id, span->task_id), span->args.begin, span->args.end,
+                StatusName(span->status), span->hedge ? "true" : "false",
+                span->queue_ns / 1e3, span->compute_ns / 1e3);
+        if (span->written_ns > span->queued_ns)
+            WriteSpan(file, trace, "send", pid, tid, span->queued_ns, span->written_ns);
+        WriteSpan(file, trace, "wait", pid, tid, span->written_ns, span->recv_ns);
+        if (span->status != STATUS_OK)
+            continue;
+
+        uint64_t wait = span->recv_ns - span->written_ns;
+        uint64_t server = span->queue_ns + span->compute_ns;
+        uint64_t net = wait > server ? wait - server : 0;
+        uint64_t server_start = span->written_ns + net / 2;
+        uint64_t queue_end = server_start + span->queue_ns;
+        uint64_t compute_end = queue_end + span->compute_ns;
+        if (compute_end > span->recv_ns)
+            compute_end = span->recv_ns;
+        if (queue_end > compute_end)
+            queue_end = compute_end;
+        if (queue_end > server_start)
+            WriteSpan(file, trace, "server queue", pid, tid, server_start, queue_end);
+        if (compute_end > queue_end)
+            WriteSpan(file, trace, "compute", pid, tid, queue_end, compute_end);
+
+        send_ns += span->written_ns - span->queued_ns;
+        net_ns += net;
+        queue_ns += span->queue_ns;
+        compute_ns += span->compute_ns;
+        ok++;
+    }
+    fprintf(file, "\n]}\n");
+    bool written = fclose(file) == 0;
+
+    if (ok > 0)
+        printf("Trace: %zu task copies in %s; per task avg send %.3f ms, network %.3f ms, "
+               "server queue %.3f ms, compute %.3f ms\n",
+               trace->spans_num, path, send_ns / 1e6 / ok, net_ns / 1e6 / ok,
+               queue_ns / 1e6 / ok, compute_ns / 1e6 / ok);
+    return written;
+}
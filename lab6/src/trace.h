@@ -0,0 +1,86 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+// Трасса прогона клиента. Для каждой копии задачи запоминается, когда
+// она попала в буфер отправки, когда буфер ушёл в сокет и когда разобран
+// ответ, а сервер добавляет в ответ время ожидания и счёта. Часы
+// сервера не сравниваются с клиентскими: участок сервера ставится
+// в середину ожидания, остаток считается сетью. Результат - JSON
+// в формате Chrome trace (chrome://tracing, ui.perfetto.dev): процесс
+// на сервер, подключение и задачи на отдельных дорожках.
+// Клиент однопоточный, поэтому блокировок нет.
+
+// Копия задачи пропала вместе с сервером
+#define TRACE_STATUS_LOST UINT32_MAX
+
+struct TraceSpan {
+    uint64_t task_id;
+    struct FactorialArgs args;
+    int server;  // -1 - слот свободен
+    int lane;
+    uint32_t status;
+    bool hedge;  // вторая копия задачи
+    uint64_t queued_ns;   // записана в буфер отправки
+    uint64_t written_ns;  // буфер целиком ушёл в сокет, 0 - ещё нет
+    uint64_t recv_ns;     // ответ разобран
+    uint64_t queue_ns;    // по данным сервера
+    uint64_t compute_ns;
+};
+
+struct TraceServer {
+    const char *name;
+    uint64_t connect_start_ns;
+    uint64_t connect_done_ns;
+    uint64_t failed_ns;
+    // Копии, отправка которых ещё не закончилась (индексы в pending)
+    size_t *unflushed;
+    size_t unflushed_num;
+    size_t unflushed_cap;
+};
+
+struct Trace {
+    uint64_t run_id;
+    uint64_t start_ns;
+    // Копии в полёте: по два слота на задачу, pending[2 * id + copy]
+    struct TraceSpan *pending;
+    size_t tasks_num;
+    // Завершённые копии
+    struct TraceSpan *spans;
+    size_t spans_num;
+    size_t spans_cap;
+    struct TraceServer *servers;
+    int servers_num;
+};
+
+// Случайный идентификатор прогона, из него получаются trace_id задач
+uint64_t TraceRunId(void);
+
+static inline uint64_t TraceId(uint64_t run_id, uint64_t task_id) {
+    return run_id ^ task_id;
+}
+
+bool TraceInit(struct Trace *trace, uint64_t run_id, size_t tasks_num, int servers_num);
+void TraceDestroy(struct Trace *trace);
+
+void TraceConnectStart(struct Trace *trace, int server, const char *name);
+void TraceConnectDone(struct Trace *trace, int server);
+
+// Задача записана в буфер отправки соединения
+void TraceQueued(struct Trace *trace, int server, uint64_t task_id,
+                 const struct FactorialArgs *args);
+// Буфер отправки соединения опустел
+void TraceWritten(struct Trace *trace, int server);
+void TraceReceived(struct Trace *trace, int server, const struct ResultMsg *result);
+// Сервер отказал: его копии в полёте закрываются со статусом lost
+void TraceServerFailed(struct Trace *trace, int server);
+
+// Пишет JSON и печатает, куда в среднем ушло время задач
+bool TraceWrite(struct Trace *trace, const char *path);
+
+#endif
@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+
+#include "transport.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+
+// Абстрактное имя сокета shm-сервера: в файловой системе его нет
+#define SHM_SOCKET_PREFIX "os_lab6.shm."
+
+static const char *LocalAddr(struct sockaddr_un *sun, socklen_t *len,
+                             const char *path, bool abstract) {
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    size_t path_len = strlen(path);
+    if (path_len == 0)
+        return "empty path";
+
+    if (abstract) {
+        // Первый байт sun_path нулевой, имя идёт следом без завершающего нуля
+        if (1 + strlen(SHM_SOCKET_PREFIX) + path_len > sizeof(sun->sun_path))
+            return "name is too long";
+        memcpy(sun->sun_path + 1, SHM_SOCKET_PREFIX, strlen(SHM_SOCKET_PREFIX));
+        memcpy(sun->sun_path + 1 + strlen(SHM_SOCKET_PREFIX), path, path_len);
+        *len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(SHM_SOCKET_PREFIX) + path_len;
+    } else {
+        if (path_len >= sizeof(sun->sun_path))
+            return "path is too long";
+        memcpy(sun->sun_path, path, path_len);
+        *len = offsetof(struct sockaddr_un, sun_path) + path_len + 1;
+    }
+    return NULL;
+}
+
+const char *TransportResolve(const char *spec, struct TransportAddr *addr) {
+    memset(addr, 0, sizeof(*addr));
+
+    if (strncmp(spec, "unix:", 5) == 0 || strncmp(spec, "shm:", 4) == 0) {
+        bool shm = spec[0] == 's';
+        addr->type = shm ? TRANSPORT_SHM : TRANSPORT_UNIX;
+        return LocalAddr((struct sockaddr_un *)&addr->addr, &addr->addr_len,
+                         spec + (shm ? 4 : 5), shm);
+    }
+
+    addr->type = TRANSPORT_TCP;
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || atoi(colon + 1) <= 0)
+        return "expected host:port, unix:/path or shm:name";
+
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    // Берётся первый адрес
+    struct addrinfo *result;
+    int rc = getaddrinfo(host, colon + 1, &hints, &result);
+    if (rc != 0)
+        return gai_strerror(rc);
+    memcpy(&addr->addr, result->ai_addr, result->ai_addrlen);
+    addr->addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return NULL;
+}
+
+int TransportListen(const struct TransportAddr *addr) {
+    if (addr->type == TRANSPORT_TCP)
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    // Файл сокета мог остаться от прошлого запуска
+    const struct sockaddr_un *sun = (const struct sockaddr_un *)&addr->addr;
+    if (addr->type == TRANSPORT_UNIX)
+        unlink(sun->sun_path);
+
+    if (bind(fd, (const struct sockaddr *)&addr->addr, addr->addr_len) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Сегмент и eventfd передаются одним сообщением: memfd, eventfd
+// клиента, eventfd сервера
+#define SHM_FDS 3
+
+bool ShmAccept(struct ShmChannel *chan, int sock) {
+    memset(chan, 0, sizeof(*chan));
+    chan->sock = sock;
+    chan->wake_fd = chan->peer_fd = -1;
+
+    int memfd = memfd_create("os_lab6_shm", MFD_CLOEXEC);
+    if (memfd < 0)
+        return false;
+    if (ftruncate(memfd, sizeof(struct ShmSegment)) < 0) {
+        close(memfd);
+        return false;
+    }
+    void *seg = mmap(NULL, sizeof(struct ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (seg == MAP_FAILED) {
+        close(memfd);
+        return false;
+    }
+    chan->seg = seg;
+    chan->rx = &chan->seg->rings[0];
+    chan->tx = &chan->seg->rings[1];
+    chan->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    chan->peer_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    bool ok = chan->wake_fd >= 0 && chan->peer_fd >= 0;
+    if (ok) {
+        int fds[SHM_FDS] = {memfd, chan->peer_fd, chan->wake_fd};
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(sizeof(fds))];
+        } control;
+        memset(&control, 0, sizeof(control));
+
+        char byte = 0;
+        struct iovec iov = {&byte, 1};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        ok = sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+    }
+
+    close(memfd);
+    if (!ok)
+        ShmClose(chan);
+    return ok;
+}
+
+bool ShmConnect(struct ShmChannel *chan, int sock, int timeout_ms) {
+    memset(chan, 0, sizeof(*chan));
+    chan->sock = sock;
+    chan->wake_fd = chan->peer_fd = -1;
+
+    struct pollfd pfd = {sock, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return false;
+    return ShmTryConnect(chan, sock) == 1;
+}
+
+int ShmTryConnect(struct ShmChannel *chan, int sock) {
+    memset(chan, 0, sizeof(*chan));
+    chan->sock = sock;
+    chan->wake_fd = chan->peer_fd = -1;
+
+    int fds[SHM_FDS];
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+
+    char byte;
+    struct iovec iov = {&byte, 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if (n != 1)
+        return -1;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+        return -1;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    void *seg = mmap(NULL, sizeof(struct ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    chan->wake_fd = fds[1];
+    chan->peer_fd = fds[2];
+    if (seg == MAP_FAILED) {
+        ShmClose(chan);
+        return -1;
+    }
+    chan->seg = seg;
+    chan->rx = &chan->seg->rings[1];
+    chan->tx = &chan->seg->rings[0];
+    return 1;
+}
+
+void ShmClose(struct ShmChannel *chan) {
+    if (chan->seg != NULL)
+        munmap(chan->seg, sizeof(struct ShmSegment));
+    if (chan->wake_fd >= 0)
+        close(chan->wake_fd);
+    if (chan->peer_fd >= 0)
+        close(chan->peer_fd);
+    chan->seg = NULL;
+    chan->rx = chan->tx = NULL;
+    chan->wake_fd = chan->peer_fd = -1;
+}
+
+size_t ShmRecv(struct ShmChannel *chan, void *buf, size_t len) {
+    struct ShmRing *ring = chan->rx;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t n = head - tail;
+    if (n > len)
+        n = len;
+    if (n == 0)
+        return 0;
+
+    size_t pos = tail & (SHM_RING_SIZE - 1);
+    size_t first = SHM_RING_SIZE - pos < n ? SHM_RING_SIZE - pos : n;
+    memcpy(buf, ring->data + pos, first);
+    memcpy((char *)buf + first, ring->data, n - first);
+
+    // Запись tail и чтение want_space упорядочены с записью флага
+    // и перечитыванием tail у писателя: хотя бы одна сторона увидит
+    // изменения другой, и пробуждение не потеряется
+    __atomic_store_n(&ring->tail, tail + (uint32_t)n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->want_space, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ring->want_space, 0, __ATOMIC_SEQ_CST))
+        ShmNotify(chan);
+    return n;
+}
+
+size_t ShmSend(struct ShmChannel *chan, const void *buf, size_t len) {
+    struct ShmRing *ring = chan->tx;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t space = SHM_RING_SIZE - (head - tail);
+    if (space == 0) {
+        __atomic_store_n(&ring->want_space, 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+        space = SHM_RING_SIZE - (head - tail);
+        if (space == 0)
+            return 0;
+    }
+
+    size_t n = len < space ? len : space;
+    size_t pos = head & (SHM_RING_SIZE - 1);
+    size_t first = SHM_RING_SIZE - pos < n ? SHM_RING_SIZE - pos : n;
+    memcpy(ring->data + pos, buf, first);
+    memcpy(ring->data, (const char *)buf + first, n - first);
+    __atomic_store_n(&ring->head, head + (uint32_t)n, __ATOMIC_RELEASE);
+    return n;
+}
+
+static void EventSignal(int fd) {
+    uint64_t one = 1;
+    // EAGAIN только при переполнении счётчика: собеседник и так разбужен
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+void ShmNotify(struct ShmChannel *chan) {
+    EventSignal(chan->peer_fd);
+}
+
+void ShmWakeSelf(struct ShmChannel *chan) {
+    EventSignal(chan->wake_fd);
+}
+
+void ShmDrainWake(struct ShmChannel *chan) {
+    uint64_t counter;
+    while (read(chan->wake_fd, &counter, sizeof(counter)) < 0 && errno == EINTR)
+        ;
+}
+
+bool ShmWait(struct ShmChannel *chan) {
+    struct pollfd fds[2] = {{chan->wake_fd, POLLIN, 0}, {chan->sock, POLLIN | POLLRDHUP, 0}};
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+    // После установки соединения по сокету ничего не приходит:
+    // любое событие на нём означает отключение
+    if (fds[1].revents != 0)
+        return false;
+    ShmDrainWake(chan);
+    return true;
+}
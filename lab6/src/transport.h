@@ -0,0 +1,106 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/socket.h>
+
+// Транспорты между клиентом и сервером. Кадры везде одинаковые,
+// меняется только то, как байты попадают к собеседнику:
+//   host:port  - TCP;
+//   unix:/path - сокет AF_UNIX в файловой системе;
+//   shm:name   - пара колец в общей памяти. Клиент подключается к
+//                абстрактному unix-сокету, сервер передаёт ему через
+//                SCM_RIGHTS memfd с кольцами и два eventfd для
+//                пробуждений. Сокет остаётся открытым только для того,
+//                чтобы обе стороны заметили отключение собеседника.
+enum TransportType {
+    TRANSPORT_TCP,
+    TRANSPORT_UNIX,
+    TRANSPORT_SHM,
+};
+
+struct TransportAddr {
+    enum TransportType type;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+};
+
+// Разбирает и разрешает адрес. Возвращает NULL или текст ошибки
+const char *TransportResolve(const char *spec, struct TransportAddr *addr);
+
+// Слушающий сокет для unix: и shm: адресов (TCP слушает сервер сам)
+int TransportListen(const struct TransportAddr *addr);
+
+// Размер кольца одного направления, степень двойки
+#define SHM_RING_SIZE (256 * 1024)
+
+// Кольцо с одним писателем и одним читателем. head и tail растут
+// без остановки, позиция в data - по модулю SHM_RING_SIZE. Писатель,
+// упёршийся в заполненное кольцо, ставит want_space, и читатель будит
+// его, когда освободит место. Поля разнесены по строкам кэша.
+struct ShmRing {
+    uint32_t head;
+    uint32_t want_space;
+    char pad1[56];
+    uint32_t tail;
+    char pad2[60];
+    char data[SHM_RING_SIZE];
+};
+
+// Общий сегмент: rings[0] - к серверу, rings[1] - к клиенту
+struct ShmSegment {
+    struct ShmRing rings[2];
+};
+
+// Одна сторона shm-соединения. Собеседник пишет в wake_fd, когда
+// положил данные в rx или освободил место в tx, которого мы ждали
+struct ShmChannel {
+    struct ShmSegment *seg;
+    struct ShmRing *rx;
+    struct ShmRing *tx;
+    int wake_fd;
+    int peer_fd;
+    int sock;
+};
+
+// Сервер: создаёт сегмент и eventfd для нового соединения sock и
+// отправляет их клиенту
+bool ShmAccept(struct ShmChannel *chan, int sock);
+
+// Клиент: получает сегмент от сервера, ожидая не дольше timeout_ms
+bool ShmConnect(struct ShmChannel *chan, int sock, int timeout_ms);
+
+// Клиент: то же без ожидания. 1 - сегмент получен, 0 - сервер его
+// ещё не прислал (ждать EPOLLIN на sock), -1 - ошибка
+int ShmTryConnect(struct ShmChannel *chan, int sock);
+
+// Снимает отображение и закрывает eventfd (но не sock)
+void ShmClose(struct ShmChannel *chan);
+
+// Копирует из rx не больше len байт. Возвращает число байт, 0 - кольцо пусто
+size_t ShmRecv(struct ShmChannel *chan, void *buf, size_t len);
+
+// Копирует в tx не больше len байт. Возвращает число байт; если
+// кольцо заполнено, просит собеседника разбудить нас
+size_t ShmSend(struct ShmChannel *chan, const void *buf, size_t len);
+
+static inline bool ShmReadable(const struct ShmChannel *chan) {
+    return __atomic_load_n(&chan->rx->head, __ATOMIC_ACQUIRE) != chan->rx->tail;
+}
+
+// Будит собеседника
+void ShmNotify(struct ShmChannel *chan);
+
+// Будит себя: в rx остались данные, которые не влезли в буфер
+void ShmWakeSelf(struct ShmChannel *chan);
+
+// Сбрасывает счётчик своего eventfd перед разбором кольца
+void ShmDrainWake(struct ShmChannel *chan);
+
+// Блокирующее ожидание пробуждения. false - собеседник отключился
+bool ShmWait(struct ShmChannel *chan);
+
+#endif
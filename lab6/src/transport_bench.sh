@@ -0,0 +1,51 @@
+#!/bin/bash
+# Задержка одной задачи через разные транспорты: TCP по loopback,
+# unix-сокет и кольца в общей памяти. Сервер слушает все три адреса
+# сразу, loadgen по очереди гоняет по каждому мелкие задачи
+# (по умолчанию одна задача в полёте), чтобы в задержке была видна
+# стоимость доставки, а не счёта. Результат - CSV на stdout.
+#
+# Использование: ./transport_bench.sh [порт] [tnum]
+
+port=${1:-20102}
+tnum=${2:-2}
+duration=${DURATION:-3}
+connections=${CONNECTIONS:-1}
+inflight=${INFLIGHT:-1}
+
+if [ ! -x ./server ] || [ ! -x ./loadgen ]; then
+    echo "Ошибка: сначала соберите server и loadgen (make)" >&2
+    exit 1
+fi
+
+tmp=$(mktemp -d)
+sock="$tmp/server.sock"
+shm="bench$$"
+server_pid=
+
+cleanup() {
+    if [ -n "$server_pid" ]; then
+        kill "$server_pid" 2>/dev/null
+        wait "$server_pid" 2>/dev/null
+    fi
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+./server --port "$port" --tnum "$tnum" --unix "$sock" --shm "$shm" --log-level warn &
+server_pid=$!
+sleep 0.5
+
+echo "transport,connections,inflight,qps,p50_us,p99_us,p999_us"
+for addr in "127.0.0.1:$port" "unix:$sock" "shm:$shm"; do
+    ./loadgen --server "$addr" --mode closed --connections "$connections" --inflight "$inflight" \
+        --range fixed:1 --duration "$duration" --csv > "$tmp/run.csv" || {
+        echo "Ошибка: loadgen не смог отработать через $addr" >&2
+        exit 1
+    }
+    tail -n 1 "$tmp/run.csv" | awk -F, -v t="${addr%%:*}" '
+        {
+            if (t != "unix" && t != "shm") t = "tcp"
+            printf "%s,%d,%d,%.0f,%.0f,%.0f,%.0f\n", t, $2, $3, $10, $11 * 1000, $12 * 1000, $13 * 1000
+        }'
+done
@@ -1,28 +1,257 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define SADDR struct sockaddr
 #define SIZE sizeof(struct sockaddr_in)
 
+struct bulk {
+  bool on;
+  const char *file;
+  double seconds;  // 0 - без ограничения
+  uint64_t bytes;  // 0 - без ограничения
+  double interval;
+  double cpu_mhz;  // 0 - взять из /proc/cpuinfo
+};
+
+static void usage(const char *prog) {
+  printf("Usage: %s [--bulk [--file path] [--time sec] [--bytes n] [--interval sec]\n"
+         "       %*s  [--cpu-mhz f]] [--sndbuf n] [--rcvbuf n] <ip> <port> <bufsize>\n",
+         prog, (int)strlen(prog), "");
+  exit(1);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double cpu_sec(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec +
+         ru.ru_stime.tv_usec / 1e6;
+}
+
+/* Частота из /proc/cpuinfo, МГц; 0, если её там нет */
+static double cpuinfo_mhz(void) {
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (f == NULL)
+    return 0;
+  char line[256];
+  double mhz = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, "cpu MHz", 7) == 0) {
+      char *colon = strchr(line, ':');
+      if (colon)
+        mhz = atof(colon + 1);
+      break;
+    }
+  }
+  fclose(f);
+  return mhz;
+}
+
+/* Такты на байт оцениваются как процессорное время (user + sys) на
+ * частоту: получается цена байта для клиента вместе с ядром */
+static void print_line(const char *label, uint64_t bytes, double secs, double cpu, double mhz) {
+  printf("%-14s %10.1f MB  %7.3f GB/s  CPU %5.1f%%", label, bytes / 1e6,
+         secs > 0 ? bytes / secs / 1e9 : 0.0, secs > 0 ? 100.0 * cpu / secs : 0.0);
+  if (mhz > 0 && bytes > 0)
+    printf("  %6.3f cycles/B", cpu * mhz * 1e6 / bytes);
+  printf("\n");
+  fflush(stdout);
+}
+
+static uint64_t parse_size(const char *s) {
+  char *end;
+  double v = strtod(s, &end);
+  switch (*end) {
+  case 'k':
+  case 'K':
+    v *= 1024;
+    break;
+  case 'm':
+  case 'M':
+    v *= 1024 * 1024;
+    break;
+  case 'g':
+  case 'G':
+    v *= 1024.0 * 1024 * 1024;
+    break;
+  }
+  return v > 0 ? (uint64_t)v : 0;
+}
+
+static void run_bulk(int fd, int bufsize, struct bulk *b) {
+  int filefd = -1;
+  if (b->file && (filefd = open(b->file, O_RDONLY)) < 0) {
+    perror("open");
+    exit(1);
+  }
+
+  /* Шаблон: повторяющиеся байты, чтобы приёмник мог их проверить */
+  char *buf = malloc(bufsize);
+  if (buf == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  for (int i = 0; i < bufsize; i++)
+    buf[i] = (char)i;
+
+  double mhz = b->cpu_mhz > 0 ? b->cpu_mhz : cpuinfo_mhz();
+  if (mhz <= 0)
+    fprintf(stderr, "CPU frequency unknown, pass --cpu-mhz to get cycles per byte\n");
+  printf("Sending %s, %s%s\n", b->file ? b->file : "pattern",
+         b->seconds > 0 ? "time limit" : (b->bytes > 0 ? "byte limit" : "until end of file"),
+         mhz > 0 ? "" : ", no cycles estimate");
+
+  uint64_t start = now_ns();
+  uint64_t interval_ns = (uint64_t)(b->interval * 1e9);
+  uint64_t deadline = b->seconds > 0 ? start + (uint64_t)(b->seconds * 1e9) : 0;
+  uint64_t mark = start;
+  double cpu_start = cpu_sec();
+  double cpu_mark = cpu_start;
+  uint64_t total = 0, interval_bytes = 0;
+
+  while (1) {
+    size_t want = bufsize;
+    if (b->bytes > 0) {
+      if (total >= b->bytes)
+        break;
+      if (b->bytes - total < want)
+        want = b->bytes - total;
+    }
+
+    ssize_t n;
+    if (filefd >= 0)
+      n = sendfile(fd, filefd, NULL, want);
+    else
+      n = write(fd, buf, want);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror(filefd >= 0 ? "sendfile" : "write");
+      exit(1);
+    }
+    if (n == 0)
+      break;
+    total += n;
+    interval_bytes += n;
+
+    uint64_t now = now_ns();
+    if (now - mark >= interval_ns) {
+      double cpu = cpu_sec();
+      char label[32];
+      snprintf(label, sizeof(label), "[%5.1f-%5.1f s]", (mark - start) / 1e9, (now - start) / 1e9);
+      print_line(label, interval_bytes, (now - mark) / 1e9, cpu - cpu_mark, mhz);
+      mark = now;
+      cpu_mark = cpu;
+      interval_bytes = 0;
+    }
+    if (deadline && now >= deadline)
+      break;
+  }
+
+  /* Ждём, пока сервер дочитает и закроет соединение: иначе в итог
+   * попали бы байты, которые ещё лежат в буфере отправки */
+  shutdown(fd, SHUT_WR);
+  while (read(fd, buf, bufsize) > 0)
+    ;
+
+  double secs = (now_ns() - start) / 1e9;
+  print_line("total", total, secs, cpu_sec() - cpu_start, mhz);
+  free(buf);
+  if (filefd >= 0)
+    close(filefd);
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    printf("Usage: %s <ip> <port> <bufsize>\n", argv[0]);
+  struct bulk b = {.interval = 1.0};
+  int sndbuf = 0, rcvbuf = 0;
+
+  while (1) {
+    static struct option options[] = {{"bulk", no_argument, 0, 'B'},
+                                      {"file", required_argument, 0, 'f'},
+                                      {"time", required_argument, 0, 't'},
+                                      {"bytes", required_argument, 0, 'n'},
+                                      {"interval", required_argument, 0, 'i'},
+                                      {"cpu-mhz", required_argument, 0, 'c'},
+                                      {"sndbuf", required_argument, 0, 's'},
+                                      {"rcvbuf", required_argument, 0, 'r'},
+                                      {0, 0, 0, 0}};
+    int c = getopt_long(argc, argv, "", options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'B':
+      b.on = true;
+      break;
+    case 'f':
+      b.file = optarg;
+      break;
+    case 't':
+      b.seconds = atof(optarg);
+      break;
+    case 'n':
+      b.bytes = parse_size(optarg);
+      break;
+    case 'i':
+      b.interval = atof(optarg);
+      if (b.interval <= 0) {
+        fprintf(stderr, "Interval must be positive\n");
+        exit(1);
+      }
+      break;
+    case 'c':
+      b.cpu_mhz = atof(optarg);
+      break;
+    case 's':
+      sndbuf = (int)parse_size(optarg);
+      break;
+    case 'r':
+      rcvbuf = (int)parse_size(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (argc - optind != 3)
+    usage(argv[0]);
+  if (!b.on && (b.file || b.seconds > 0 || b.bytes > 0)) {
+    fprintf(stderr, "--file, --time and --bytes need --bulk\n");
     exit(1);
   }
+  /* Без ограничений шаблон шёл бы бесконечно */
+  if (b.on && !b.file && b.seconds <= 0 && b.bytes == 0)
+    b.seconds = 10;
 
-  char *ip = argv[1];
-  int port = atoi(argv[2]);
-  int bufsize = atoi(argv[3]);
+  char *ip = argv[optind];
+  int port = atoi(argv[optind + 1]);
+  int bufsize = (int)parse_size(argv[optind + 2]);
+  if (bufsize <= 0) {
+    fprintf(stderr, "Bufsize must be positive\n");
+    exit(1);
+  }
 
   int fd;
-  int nread;
-  char buf[bufsize];
   struct sockaddr_in servaddr;
 
   if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -30,6 +259,13 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
+  /* Размеры буферов задаются до connect: от них зависит окно,
+   * о котором стороны договариваются при установке соединения */
+  if (sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0)
+    perror("SO_SNDBUF");
+  if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)
+    perror("SO_RCVBUF");
+
   memset(&servaddr, 0, SIZE);
   servaddr.sin_family = AF_INET;
 
@@ -45,6 +281,22 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
+  if (b.on) {
+    socklen_t len = sizeof(int);
+    int snd = 0, rcv = 0;
+    getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &snd, &len);
+    len = sizeof(int);
+    getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcv, &len);
+    printf("Connected to %s:%d, SO_SNDBUF %d, SO_RCVBUF %d, chunk %d\n", ip, port, snd, rcv,
+           bufsize);
+    run_bulk(fd, bufsize, &b);
+    close(fd);
+    exit(0);
+  }
+
+  int nread;
+  char buf[bufsize];
+
   write(1, "Input message to send\n", 22);
   while ((nread = read(0, buf, bufsize)) > 0) {
     if (write(fd, buf, nread) < 0) {
@@ -55,4 +307,4 @@ int main(int argc, char *argv[]) {
 
   close(fd);
   exit(0);
-}
\ No newline at end of file
+}
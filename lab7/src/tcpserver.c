@@ -1,33 +1,475 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define SADDR struct sockaddr
+#define MAX_EVENTS 256
+#define ACCEPT_BATCH 64
+#define REPORT_NS 1000000000ULL
 
-int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    printf("Usage: %s <port> <bufsize>\n", argv[0]);
-    exit(1);
+enum mode { MODE_SINGLE, MODE_ECHO, MODE_SINK };
+
+struct conn {
+  int fd;
+  int id;
+  char *buf;
+  int pend_off;
+  int pend_len;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t interval_in;
+  uint64_t start_ns;
+  struct conn *prev;
+  struct conn *next;
+};
+
+struct server {
+  int lfd;
+  int epfd;
+  int bufsize;
+  enum mode mode;
+  struct conn *conns;
+  int active;
+  int next_id;
+  bool accept_paused;  // кончились дескрипторы, lfd снят с EPOLLIN
+  uint64_t accepted;
+  uint64_t interval_in;
+  uint64_t interval_out;
+};
+
+static void usage(const char *prog) {
+  printf("Usage: %s [--mode single|echo|sink] [--backlog 5] [--splice] [--output file]\n"
+         "       %*s <port> <bufsize>\n",
+         prog, (int)strlen(prog), "");
+  exit(1);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double cpu_sec(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec +
+         ru.ru_stime.tv_usec / 1e6;
+}
+
+static void write_all(int fd, const char *buf, ssize_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("write");
+      exit(1);
+    }
+    buf += n;
+    len -= n;
   }
+}
 
-  int serv_port = atoi(argv[1]);
-  int bufsize = atoi(argv[2]);
+/* Сокет -> pipe -> outfd без копирования в память процесса.
+ * Возвращает 0 при конце данных и 1, если splice здесь не работает
+ * (EINVAL): застрявшее в pipe уже дописано обычным write */
+static int splice_conn(int cfd, int outfd, int pipefd[2], int bufsize, char *buf,
+                       uint64_t *total) {
+  while (1) {
+    ssize_t n = splice(cfd, NULL, pipefd[1], NULL, bufsize, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EINVAL && *total == 0)
+        return 1;
+      perror("splice");
+      exit(1);
+    }
+    if (n == 0)
+      return 0;
 
-  int lfd, cfd;
+    ssize_t left = n;
+    while (left > 0) {
+      ssize_t m = splice(pipefd[0], NULL, outfd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (m < 0 && errno == EINTR)
+        continue;
+      if (m < 0 && errno == EINVAL) {
+        while (left > 0) {
+          ssize_t r = read(pipefd[0], buf, left < bufsize ? left : bufsize);
+          if (r <= 0) {
+            perror("read");
+            exit(1);
+          }
+          write_all(outfd, buf, r);
+          left -= r;
+        }
+        *total += n;
+        return 1;
+      }
+      if (m <= 0) {
+        perror("splice");
+        exit(1);
+      }
+      left -= m;
+    }
+    *total += n;
+  }
+}
+
+static void serve_single(int lfd, int bufsize, int outfd, bool use_splice) {
+  int cfd;
   int nread;
   char buf[bufsize];
-  struct sockaddr_in servaddr;
   struct sockaddr_in cliaddr;
+  int pipefd[2];
+
+  if (use_splice) {
+    if (pipe(pipefd) < 0) {
+      perror("pipe");
+      exit(1);
+    }
+    fcntl(pipefd[1], F_SETPIPE_SZ, bufsize);
+  }
+
+  while (1) {
+    unsigned int clilen = sizeof(cliaddr);
+
+    if ((cfd = accept(lfd, (SADDR *)&cliaddr, &clilen)) < 0) {
+      perror("accept");
+      exit(1);
+    }
+    printf("Connection established\n");
+    fflush(stdout);
+
+    uint64_t total = 0;
+    uint64_t start = now_ns();
+    double cpu_start = cpu_sec();
+    bool spliced = use_splice;
+    if (use_splice && splice_conn(cfd, outfd, pipefd, bufsize, buf, &total) == 1) {
+      fprintf(stderr, "splice is not supported for this socket or output, using read/write\n");
+      use_splice = spliced = false;
+    }
+
+    if (!spliced) {
+      while ((nread = read(cfd, buf, bufsize)) > 0) {
+        write_all(outfd, buf, nread);
+        total += nread;
+      }
+
+      if (nread == -1) {
+        perror("read");
+        exit(1);
+      }
+    }
+    close(cfd);
+
+    double secs = (now_ns() - start) / 1e9;
+    double cpu = cpu_sec() - cpu_start;
+    fprintf(stderr, "%s: %lu bytes in %.3f s, %.3f GB/s, CPU %.1f%% (%.3f s)\n",
+            spliced ? "splice" : "read/write", total, secs, secs > 0 ? total / secs / 1e9 : 0.0,
+            secs > 0 ? 100.0 * cpu / secs : 0.0, cpu);
+  }
+}
+
+/* Слушающий сокет уровневый: пока accept падает с EMFILE, epoll будил
+ * бы цикл снова и снова. Приём снимается с EPOLLIN и возвращается,
+ * когда закроется соединение или пройдёт секунда до отчёта */
+static void set_accepting(struct server *srv, bool on) {
+  struct epoll_event ev;
+  ev.events = on ? EPOLLIN : 0;
+  ev.data.ptr = NULL;
+  epoll_ctl(srv->epfd, EPOLL_CTL_MOD, srv->lfd, &ev);
+  srv->accept_paused = !on;
+}
+
+static void conn_close(struct server *srv, struct conn *c) {
+  double secs = (now_ns() - c->start_ns) / 1e9;
+  printf("Connection %d closed: %lu bytes in, %lu bytes out, %.3f s, %.2f MB/s\n",
+         c->id, c->bytes_in, c->bytes_out, secs,
+         secs > 0 ? c->bytes_in / secs / 1e6 : 0.0);
+
+  epoll_ctl(srv->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    srv->conns = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+  srv->active--;
+  free(c->buf);
+  free(c);
+  if (srv->accept_paused)
+    set_accepting(srv, true);
+}
+
+static void conn_watch(struct server *srv, struct conn *c, uint32_t events) {
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = c;
+  epoll_ctl(srv->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void accept_clients(struct server *srv) {
+  for (int i = 0; i < ACCEPT_BATCH; i++) {
+    int cfd = accept4(srv->lfd, NULL, NULL, SOCK_NONBLOCK);
+    if (cfd < 0) {
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+        fprintf(stderr, "accept: %s, paused with %d active connections\n", strerror(errno),
+                srv->active);
+        set_accepting(srv, false);
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("accept");
+      }
+      return;
+    }
+
+    struct conn *c = calloc(1, sizeof(struct conn));
+    if (c == NULL || (c->buf = malloc(srv->bufsize)) == NULL) {
+      free(c);
+      close(cfd);
+      continue;
+    }
+    c->fd = cfd;
+    c->id = srv->next_id++;
+    c->start_ns = now_ns();
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, cfd, &ev) < 0) {
+      perror("epoll_ctl");
+      close(cfd);
+      free(c->buf);
+      free(c);
+      continue;
+    }
+    c->next = srv->conns;
+    if (srv->conns)
+      srv->conns->prev = c;
+    srv->conns = c;
+    srv->active++;
+    srv->accepted++;
+  }
+}
+
+static bool conn_flush(struct server *srv, struct conn *c) {
+  while (c->pend_len > 0) {
+    /* MSG_NOSIGNAL: клиент, сбросивший соединение, даёт EPIPE на
+     * запись, а не SIGPIPE, который убил бы весь сервер */
+    ssize_t n = send(c->fd, c->buf + c->pend_off, c->pend_len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        conn_watch(srv, c, EPOLLOUT);
+        return true;
+      }
+      return false;
+    }
+    c->pend_off += n;
+    c->pend_len -= n;
+    c->bytes_out += n;
+    srv->interval_out += n;
+  }
+  return true;
+}
+
+/* Один read на событие: при уровневом epoll соединение вернётся
+ * в следующем проходе, и поток одного клиента не задержит остальных */
+static void conn_handle(struct server *srv, struct conn *c) {
+  if (c->pend_len > 0) {
+    if (!conn_flush(srv, c)) {
+      conn_close(srv, c);
+      return;
+    }
+    if (c->pend_len == 0)
+      conn_watch(srv, c, EPOLLIN);
+    return;
+  }
+
+  ssize_t n = read(c->fd, c->buf, srv->bufsize);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return;
+  if (n <= 0) {
+    if (n < 0)
+      perror("read");
+    conn_close(srv, c);
+    return;
+  }
+  c->bytes_in += n;
+  c->interval_in += n;
+  srv->interval_in += n;
+
+  if (srv->mode == MODE_ECHO) {
+    c->pend_off = 0;
+    c->pend_len = n;
+    if (!conn_flush(srv, c))
+      conn_close(srv, c);
+  }
+}
+
+static void report(struct server *srv, double secs) {
+  double min = -1, max = 0;
+  for (struct conn *c = srv->conns; c; c = c->next) {
+    double rate = c->interval_in / secs / 1e6;
+    if (min < 0 || rate < min)
+      min = rate;
+    if (rate > max)
+      max = rate;
+    c->interval_in = 0;
+  }
+  printf("active %d, accepted %lu, in %.2f MB/s, out %.2f MB/s, per connection min %.2f max %.2f MB/s\n",
+         srv->active, srv->accepted, srv->interval_in / secs / 1e6,
+         srv->interval_out / secs / 1e6, min < 0 ? 0 : min, max);
+  fflush(stdout);
+  srv->interval_in = 0;
+  srv->interval_out = 0;
+}
+
+static void serve_epoll(int lfd, int bufsize, enum mode mode) {
+  struct server srv;
+  memset(&srv, 0, sizeof(srv));
+  srv.lfd = lfd;
+  srv.bufsize = bufsize;
+  srv.mode = mode;
+
+  if (fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK) < 0) {
+    perror("fcntl");
+    exit(1);
+  }
+  if ((srv.epfd = epoll_create1(0)) < 0) {
+    perror("epoll_create1");
+    exit(1);
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(srv.epfd, EPOLL_CTL_ADD, lfd, &ev) < 0) {
+    perror("epoll_ctl");
+    exit(1);
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  uint64_t last = now_ns();
+  while (1) {
+    int n = epoll_wait(srv.epfd, events, MAX_EVENTS, 1000);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL)
+        accept_clients(&srv);
+      else
+        conn_handle(&srv, events[i].data.ptr);
+    }
+
+    uint64_t now = now_ns();
+    if (now - last >= REPORT_NS) {
+      if (srv.active > 0 || srv.interval_in > 0)
+        report(&srv, (now - last) / 1e9);
+      last = now;
+      /* Дескрипторы могли освободиться не у нас, а в системе */
+      if (srv.accept_paused)
+        set_accepting(&srv, true);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  enum mode mode = MODE_SINGLE;
+  int backlog = 5;
+  bool use_splice = false;
+  const char *output = NULL;
+
+  while (1) {
+    static struct option options[] = {{"mode", required_argument, 0, 'm'},
+                                      {"backlog", required_argument, 0, 'b'},
+                                      {"splice", no_argument, 0, 's'},
+                                      {"output", required_argument, 0, 'o'},
+                                      {0, 0, 0, 0}};
+    int c = getopt_long(argc, argv, "", options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'm':
+      if (strcmp(optarg, "single") == 0) {
+        mode = MODE_SINGLE;
+      } else if (strcmp(optarg, "echo") == 0) {
+        mode = MODE_ECHO;
+      } else if (strcmp(optarg, "sink") == 0) {
+        mode = MODE_SINK;
+      } else {
+        fprintf(stderr, "Unknown mode: %s (single, echo, sink)\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'b':
+      backlog = atoi(optarg);
+      if (backlog <= 0) {
+        fprintf(stderr, "Backlog must be positive\n");
+        exit(1);
+      }
+      break;
+    case 's':
+      use_splice = true;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (argc - optind != 2)
+    usage(argv[0]);
+  if ((use_splice || output) && mode != MODE_SINGLE) {
+    fprintf(stderr, "--splice and --output work only in single mode\n");
+    exit(1);
+  }
+
+  int outfd = 1;
+  if (output && (outfd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror("open");
+    exit(1);
+  }
+
+  int serv_port = atoi(argv[optind]);
+  int bufsize = atoi(argv[optind + 1]);
+  if (bufsize <= 0) {
+    fprintf(stderr, "Bufsize must be positive\n");
+    exit(1);
+  }
+
+  int lfd;
+  struct sockaddr_in servaddr;
 
   if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
     perror("socket");
     exit(1);
   }
 
+  int opt = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
   memset(&servaddr, 0, sizeof(servaddr));
   servaddr.sin_family = AF_INET;
   servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -38,30 +480,16 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
-  if (listen(lfd, 5) < 0) {
+  if (listen(lfd, backlog) < 0) {
     perror("listen");
     exit(1);
   }
 
   printf("TCP Server listening on port %d\n", serv_port);
+  fflush(stdout);
 
-  while (1) {
-    unsigned int clilen = sizeof(cliaddr);
-
-    if ((cfd = accept(lfd, (SADDR *)&cliaddr, &clilen)) < 0) {
-      perror("accept");
-      exit(1);
-    }
-    printf("Connection established\n");
-
-    while ((nread = read(cfd, buf, bufsize)) > 0) {
-      write(1, buf, nread);
-    }
-
-    if (nread == -1) {
-      perror("read");
-      exit(1);
-    }
-    close(cfd);
-  }
-}
\ No newline at end of file
+  if (mode == MODE_SINGLE)
+    serve_single(lfd, bufsize, outfd, use_splice);
+  else
+    serve_epoll(lfd, bufsize, mode);
+}
@@ -1,4 +1,8 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
@@ -6,24 +10,115 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define SADDR struct sockaddr
+#define FLOOD_BATCH 32
 
-int main(int argc, char **argv) {
-  if (argc != 4) {
-    printf("Usage: %s <ip> <port> <bufsize>\n", argv[0]);
+static void usage(const char *prog) {
+  printf("Usage: %s [--flood sec] <ip> <port> <bufsize>\n", prog);
+  exit(1);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Забирает пришедшие ответы, не блокируясь */
+static uint64_t drain(int sockfd, struct mmsghdr *msgs) {
+  uint64_t got = 0;
+  int n;
+  while ((n = recvmmsg(sockfd, msgs, FLOOD_BATCH, MSG_DONTWAIT, NULL)) > 0)
+    got += n;
+  return got;
+}
+
+/* Нагрузка для замера сервера: пачки датаграмм по bufsize байт через
+ * sendmmsg в течение seconds секунд, считаются отправленные и ответы */
+static void flood(int sockfd, struct sockaddr_in *servaddr, int bufsize, double seconds) {
+  char *buf = calloc(1, bufsize);
+  char *reply = malloc(bufsize);
+  struct mmsghdr out[FLOOD_BATCH], in[FLOOD_BATCH];
+  struct iovec out_iov = {buf, bufsize}, in_iov = {reply, bufsize};
+  if (buf == NULL || reply == NULL) {
+    perror("malloc");
     exit(1);
   }
+  memset(out, 0, sizeof(out));
+  memset(in, 0, sizeof(in));
+  for (int i = 0; i < FLOOD_BATCH; i++) {
+    out[i].msg_hdr.msg_iov = &out_iov;
+    out[i].msg_hdr.msg_iovlen = 1;
+    out[i].msg_hdr.msg_name = servaddr;
+    out[i].msg_hdr.msg_namelen = sizeof(*servaddr);
+    in[i].msg_hdr.msg_iov = &in_iov;
+    in[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  uint64_t sent = 0, received = 0;
+  uint64_t start = now_ns();
+  uint64_t deadline = start + (uint64_t)(seconds * 1e9);
+  while (now_ns() < deadline) {
+    int n = sendmmsg(sockfd, out, FLOOD_BATCH, 0);
+    if (n < 0) {
+      if (errno == EINTR || errno == ENOBUFS || errno == ECONNREFUSED)
+        continue;
+      perror("sendmmsg");
+      exit(1);
+    }
+    sent += n;
+    received += drain(sockfd, in);
+  }
+  double secs = (now_ns() - start) / 1e9;
+
+  /* Ответы, которые ещё в пути */
+  usleep(200000);
+  received += drain(sockfd, in);
+
+  printf("sent %lu (%.0f pps), received %lu (%.0f pps), lost %.1f%%\n", sent, sent / secs,
+         received, received / secs, sent ? 100.0 * (sent - received) / sent : 0.0);
+  free(buf);
+  free(reply);
+}
+
+int main(int argc, char **argv) {
+  double seconds = 0;
+
+  while (1) {
+    static struct option options[] = {{"flood", required_argument, 0, 'f'}, {0, 0, 0, 0}};
+    int c = getopt_long(argc, argv, "", options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'f':
+      seconds = atof(optarg);
+      if (seconds <= 0) {
+        fprintf(stderr, "Flood time must be positive\n");
+        exit(1);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
 
-  char *ip = argv[1];
-  int port = atoi(argv[2]);
-  int bufsize = atoi(argv[3]);
+  if (argc - optind != 3)
+    usage(argv[0]);
+
+  char *ip = argv[optind];
+  int port = atoi(argv[optind + 1]);
+  int bufsize = atoi(argv[optind + 2]);
+  if (bufsize <= 0) {
+    fprintf(stderr, "Bufsize must be positive\n");
+    exit(1);
+  }
 
   int sockfd, n;
-  char sendline[bufsize], recvline[bufsize + 1];
   struct sockaddr_in servaddr;
-  struct sockaddr_in cliaddr;
 
   memset(&servaddr, 0, sizeof(servaddr));
   servaddr.sin_family = AF_INET;
@@ -33,12 +128,20 @@ int main(int argc, char **argv) {
     perror("inet_pton problem");
     exit(1);
   }
-  
+
   if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
     perror("socket problem");
     exit(1);
   }
 
+  if (seconds > 0) {
+    flood(sockfd, &servaddr, bufsize, seconds);
+    close(sockfd);
+    exit(0);
+  }
+
+  char sendline[bufsize], recvline[bufsize + 1];
+
   write(1, "Enter string\n", 13);
 
   while ((n = read(0, sendline, bufsize)) > 0) {
@@ -47,12 +150,13 @@ int main(int argc, char **argv) {
       exit(1);
     }
 
-    if (recvfrom(sockfd, recvline, bufsize, 0, NULL, NULL) == -1) {
+    if ((n = recvfrom(sockfd, recvline, bufsize, 0, NULL, NULL)) == -1) {
       perror("recvfrom problem");
       exit(1);
     }
+    recvline[n] = 0;
 
     printf("REPLY FROM SERVER= %s\n", recvline);
   }
   close(sockfd);
-}
\ No newline at end of file
+}
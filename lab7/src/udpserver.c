@@ -1,34 +1,173 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define SADDR struct sockaddr
+#define REPORT_NS 1000000000ULL
 
-int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    printf("Usage: %s <port> <bufsize>\n", argv[0]);
+/* Поток со своим сокетом. Счётчики пишет только сам поток, главный
+ * поток их читает для отчёта; выравнивание по строке кеша, чтобы
+ * соседние потоки не делили её */
+struct worker {
+  pthread_t tid;
+  int id;
+  int fd;
+  int cpu;  // -1 - без привязки
+  int bufsize;
+  int batch;
+  bool quiet;
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t calls;  // recv-вызовов
+} __attribute__((aligned(64)));
+
+static void usage(const char *prog) {
+  printf("Usage: %s [--batch N] [--quiet] [--threads N] [--pin] <port> <bufsize>\n", prog);
+  exit(1);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void count(struct worker *w, uint64_t packets, uint64_t bytes) {
+  __atomic_store_n(&w->packets, w->packets + packets, __ATOMIC_RELAXED);
+  __atomic_store_n(&w->bytes, w->bytes + bytes, __ATOMIC_RELAXED);
+  __atomic_store_n(&w->calls, w->calls + 1, __ATOMIC_RELAXED);
+}
+
+/* Исходный цикл: датаграмма за вызов, каждая печатается, если не quiet */
+static void serve_loop(struct worker *w) {
+  int sockfd = w->fd;
+  int bufsize = w->bufsize;
+  int n;
+  char mesg[bufsize + 1], ipadr[16];
+  struct sockaddr_in cliaddr;
+
+  while (1) {
+    unsigned int len = sizeof(cliaddr);
+
+    if ((n = recvfrom(sockfd, mesg, bufsize, 0, (SADDR *)&cliaddr, &len)) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("recvfrom");
+      exit(1);
+    }
+
+    if (!w->quiet) {
+      mesg[n] = 0;
+      printf("REQUEST %s      FROM %s : %d\n", mesg,
+             inet_ntop(AF_INET, (void *)&cliaddr.sin_addr.s_addr, ipadr, 16),
+             ntohs(cliaddr.sin_port));
+    }
+
+    if (sendto(sockfd, mesg, n, 0, (SADDR *)&cliaddr, len) < 0) {
+      perror("sendto");
+      exit(1);
+    }
+    count(w, 1, n);
+  }
+}
+
+/* До batch датаграмм за recvmmsg и ответы на них одним sendmmsg.
+ * Буферы и адреса выделены один раз, ответ уходит из того же буфера */
+static void serve_batch(struct worker *w) {
+  int sockfd = w->fd;
+  int bufsize = w->bufsize;
+  int batch = w->batch;
+  char *bufs = malloc((size_t)batch * bufsize);
+  struct mmsghdr *msgs = calloc(batch, sizeof(struct mmsghdr));
+  struct iovec *iovs = calloc(batch, sizeof(struct iovec));
+  struct sockaddr_in *addrs = calloc(batch, sizeof(struct sockaddr_in));
+  if (bufs == NULL || msgs == NULL || iovs == NULL || addrs == NULL) {
+    perror("malloc");
     exit(1);
   }
+  for (int i = 0; i < batch; i++) {
+    iovs[i].iov_base = bufs + (size_t)i * bufsize;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+  }
+
+  while (1) {
+    for (int i = 0; i < batch; i++) {
+      iovs[i].iov_len = bufsize;
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    /* MSG_WAITFORONE: ждём первую датаграмму, остальные - сколько уже есть */
+    int n = recvmmsg(sockfd, msgs, batch, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("recvmmsg");
+      exit(1);
+    }
+
+    uint64_t bytes = 0;
+    for (int i = 0; i < n; i++) {
+      iovs[i].iov_len = msgs[i].msg_len;
+      bytes += msgs[i].msg_len;
+    }
+    int sent = 0;
+    while (sent < n) {
+      int m = sendmmsg(sockfd, msgs + sent, n - sent, 0);
+      if (m < 0) {
+        if (errno == EINTR)
+          continue;
+        perror("sendmmsg");
+        exit(1);
+      }
+      sent += m;
+    }
+    count(w, n, bytes);
+  }
+}
 
-  int serv_port = atoi(argv[1]);
-  int bufsize = atoi(argv[2]);
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  if (w->batch > 0)
+    serve_batch(w);
+  else
+    serve_loop(w);
+  return NULL;
+}
 
-  int sockfd, n;
-  char mesg[bufsize], ipadr[16];
+/* Сокет потока. SO_REUSEPORT: ядро раскладывает датаграммы по сокетам
+ * группы по хешу адресов, так что разные клиенты попадают в разные
+ * потоки, а один клиент - всегда в один */
+static int open_socket(int serv_port, bool reuseport) {
+  int sockfd;
   struct sockaddr_in servaddr;
-  struct sockaddr_in cliaddr;
 
   if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
     perror("socket problem");
     exit(1);
   }
 
+  int opt = 1;
+  if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+    perror("SO_REUSEPORT");
+    exit(1);
+  }
+
   memset(&servaddr, 0, sizeof(servaddr));
   servaddr.sin_family = AF_INET;
   servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -38,24 +177,144 @@ int main(int argc, char *argv[]) {
     perror("bind problem");
     exit(1);
   }
-  printf("UDP SERVER starts on port %d...\n", serv_port);
+  return sockfd;
+}
+
+/* Раз в секунду: пакеты в секунду по потокам и всего */
+static void report_loop(struct worker *workers, int threads) {
+  uint64_t prev[threads], prev_bytes[threads], prev_calls[threads];
+  memset(prev, 0, sizeof(prev));
+  memset(prev_bytes, 0, sizeof(prev_bytes));
+  memset(prev_calls, 0, sizeof(prev_calls));
+  uint64_t mark = now_ns();
 
   while (1) {
-    unsigned int len = sizeof(cliaddr);
+    usleep(REPORT_NS / 1000);
+    uint64_t now = now_ns();
+    double secs = (now - mark) / 1e9;
+    mark = now;
 
-    if ((n = recvfrom(sockfd, mesg, bufsize, 0, (SADDR *)&cliaddr, &len)) < 0) {
-      perror("recvfrom");
-      exit(1);
+    uint64_t packets = 0, bytes = 0, calls = 0;
+    for (int i = 0; i < threads; i++) {
+      uint64_t p = __atomic_load_n(&workers[i].packets, __ATOMIC_RELAXED);
+      uint64_t b = __atomic_load_n(&workers[i].bytes, __ATOMIC_RELAXED);
+      uint64_t c = __atomic_load_n(&workers[i].calls, __ATOMIC_RELAXED);
+      if (threads > 1 && p > prev[i]) {
+        printf("  thread %d", i);
+        if (workers[i].cpu >= 0)
+          printf(" (cpu %d)", workers[i].cpu);
+        printf(": %.0f pps\n", (p - prev[i]) / secs);
+      }
+      packets += p - prev[i];
+      bytes += b - prev_bytes[i];
+      calls += c - prev_calls[i];
+      prev[i] = p;
+      prev_bytes[i] = b;
+      prev_calls[i] = c;
+    }
+    if (packets > 0) {
+      printf("%.0f pps, %.1f MB/s, %.1f packets per call\n", packets / secs, bytes / secs / 1e6,
+             (double)packets / calls);
+      fflush(stdout);
     }
-    mesg[n] = 0;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int batch = 0;
+  bool quiet = false;
+  int threads = 1;
+  bool pin = false;
 
-    printf("REQUEST %s      FROM %s : %d\n", mesg,
-           inet_ntop(AF_INET, (void *)&cliaddr.sin_addr.s_addr, ipadr, 16),
-           ntohs(cliaddr.sin_port));
+  while (1) {
+    static struct option options[] = {{"batch", required_argument, 0, 'b'},
+                                      {"quiet", no_argument, 0, 'q'},
+                                      {"threads", required_argument, 0, 't'},
+                                      {"pin", no_argument, 0, 'p'},
+                                      {0, 0, 0, 0}};
+    int c = getopt_long(argc, argv, "", options, NULL);
+    if (c == -1)
+      break;
 
-    if (sendto(sockfd, mesg, n, 0, (SADDR *)&cliaddr, len) < 0) {
-      perror("sendto");
+    switch (c) {
+    case 'b':
+      batch = atoi(optarg);
+      if (batch <= 0) {
+        fprintf(stderr, "Batch must be positive\n");
+        exit(1);
+      }
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 't':
+      threads = atoi(optarg);
+      if (threads <= 0) {
+        fprintf(stderr, "Threads must be positive\n");
+        exit(1);
+      }
+      break;
+    case 'p':
+      pin = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (argc - optind != 2)
+    usage(argv[0]);
+
+  int serv_port = atoi(argv[optind]);
+  int bufsize = atoi(argv[optind + 1]);
+  if (bufsize <= 0) {
+    fprintf(stderr, "Bufsize must be positive\n");
+    exit(1);
+  }
+
+  /* Поток i - на i-й по счёту разрешённый процессор, по кругу */
+  cpu_set_t allowed;
+  int cpus[CPU_SETSIZE], ncpus = 0;
+  if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int c = 0; c < CPU_SETSIZE; c++)
+      if (CPU_ISSET(c, &allowed))
+        cpus[ncpus++] = c;
+  }
+
+  struct worker *workers = aligned_alloc(64, sizeof(struct worker) * threads);
+  if (workers == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  memset(workers, 0, sizeof(struct worker) * threads);
+  for (int i = 0; i < threads; i++) {
+    workers[i].id = i;
+    workers[i].fd = open_socket(serv_port, threads > 1);
+    workers[i].cpu = ncpus > 0 ? cpus[i % ncpus] : -1;
+    workers[i].bufsize = bufsize;
+    workers[i].batch = batch;
+    workers[i].quiet = quiet;
+  }
+
+  printf("UDP SERVER starts on port %d, %d thread(s)%s...\n", serv_port, threads,
+         ncpus > 0 ? ", pinned" : "");
+  fflush(stdout);
+
+  for (int i = 0; i < threads; i++) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (workers[i].cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(workers[i].cpu, &set);
+      pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    if (pthread_create(&workers[i].tid, &attr, worker_main, &workers[i]) != 0) {
+      perror("pthread_create");
       exit(1);
     }
+    pthread_attr_destroy(&attr);
   }
-}
\ No newline at end of file
+
+  report_loop(workers, threads);
+}